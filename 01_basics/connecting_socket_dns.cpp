@@ -1,4 +1,8 @@
 #include <boost/asio.hpp>
+
+#include "../common/happy_eyeballs.hpp"
+#include "../common/resolver_cache.hpp"
+
 #include <iostream>
 #include <string>
 #include <cinttypes>
@@ -9,42 +13,38 @@ int main()
 	// obtained the DNS name and protocol port number and
 	// represented them as strings
 	std::string_view host = "www.boost.org";
-	std::string_view port = "443";
+	std::uint16_t port = 443;
 
-	// Used by a 'resolver' and a 'socket'
+	// Used by a 'socket'
 	boost::asio::io_context ioc;
 
 	// Creating a resolver's query is deprecated.
 	// Skip this step
 
-	// Creating  a resolver 
-	boost::asio::ip::tcp::resolver resolver(ioc);
+	// Resolutions are cached by the process-wide ResolverCache.
+	auto &&cache = ResolverCache::getInstance();
 
 	try
 	{
 		// Step 2. Resolving a DNS name.
-		auto it = resolver.resolve(
-			host,
-			port,
-			boost::asio::ip::tcp::resolver::query::numeric_service
-		);
+		auto endpoints = cache.resolve<boost::asio::ip::tcp>(host, port);
 
 		// Step 3. Creating a socket.
 		boost::asio::ip::tcp::socket sock(ioc);
 
-		// Step 4. boost::asio::connect method iterates over
-		// each endpoint until successfully connects to one
-		// of them. It will throw an exception if it fails
-		// to connect to all the endpoints or if other
-		// error occurs.
-		boost::asio::connect(sock, it);
+		// Step 4. HappyEyeballsConnector races connections
+		// to the endpoints, IPv6 and IPv4 ones alternating,
+		// and keeps the first one established. It will throw
+		// an exception if it fails to connect to all the
+		// endpoints or if other error occurs.
+		HappyEyeballsConnector<boost::asio::ip::tcp>::connect(sock, endpoints);
 
 		// At this point socket 'sock' is connected to
 		// the server application and can be used
 		// to send data or receive data from it.
 	}
-	// Overloads of boost::asio::ip::tcp::resolver::resolve and
-	// boost::asio::connect used here throw
+	// Overloads of ResolverCache::resolve and
+	// HappyEyeballsConnector::connect used here throw
 	// exceptions in case of error condition.
 	catch (boost::system::system_error &e)
 	{
@@ -1,5 +1,8 @@
 /* dns_resolve.cpp */
 #include <boost/asio.hpp>
+
+#include "../common/resolver_cache.hpp"
+
 #include <iostream>
 
 int main()
@@ -8,28 +11,21 @@ int main()
 	// obtained the DNS name and protocol port number and
 	// represented them as strings.
 	std::string_view host = "google.com";
-	std::string_view port = "443";
+	std::uint16_t port = 443;
 
-	// Step 2.
-	boost::asio::io_context ioc;
+	// Step 2. Resolutions are cached by the process-wide
+	// ResolverCache, it runs the resolver on its own thread.
+	auto &&cache = ResolverCache::getInstance();
 
 	// Step 3. Creating a query is deprecated 
 	// Skip this step
 
-	// Step 4. Creating  a resolver 
-	boost::asio::ip::tcp::resolver resolver(ioc);
-
 	// Used to store information about error that happens
 	// during the resolution process.
 	boost::system::error_code ec;
 
-	// Step 5.
-	auto it = resolver.resolve(
-		host,
-		port,
-		boost::asio::ip::tcp::resolver::query::numeric_service,
-		ec
-	);
+	// Step 4.
+	auto endpoints = cache.resolve<boost::asio::ip::tcp>(host, port, ec);
 
 	// Handling errors if any
 	if (ec)
@@ -43,7 +39,7 @@ int main()
 		return ec.value();
 	}
 
-	std::cout << host << ':' << port << " resolved to " << it->endpoint() << '\n';
+	std::cout << host << ':' << port << " resolved to " << endpoints.front() << '\n';
 
 	return 0;
 }
@@ -1,6 +1,9 @@
 /* dns_resolve.cpp */
 
 #include <boost/asio.hpp>
+
+#include "../common/resolver_cache.hpp"
+
 #include <string>
 #include <cinttypes>
 #include <iostream>
@@ -8,31 +11,22 @@
 int main()
 {
 	std::string_view host = "yandex.ru";
-	std::string_view port = "443";
-
-	boost::asio::io_context ioc;
+	std::uint16_t port = 443;
 
-	boost::asio::ip::tcp::resolver  resolver(ioc);
+	auto &&cache = ResolverCache::getInstance();
 
 	boost::system::error_code ec;
-	boost::asio::ip::tcp::resolver::iterator end;
-	for(
-		auto it = resolver.resolve(host, port, ec);
-		it != end;
-		++it
-	)
+	auto endpoints = cache.resolve<boost::asio::ip::tcp>(host, port, ec);
+	if (ec)
+	{
+		std::cerr  
+			<< "Error code = " << ec.value() << ". Message: "
+			<< ec.message() << '\n';
+	}
+
+	for (auto &&ep : endpoints)
 	{
-		if (ec)
-		{
-			std::cerr  
-				<< "Error code = " << ec.value() << ". Message: "
-				<< ec.message() << '\n';
-		}
-		else
-		{
-			boost::asio::ip::tcp::endpoint ep = *it;
-			std::cout << host << ':' << port << " is " <<  ep << '\n';
-		}
+		std::cout << host << ':' << port << " is " <<  ep << '\n';
 	}
 
 	
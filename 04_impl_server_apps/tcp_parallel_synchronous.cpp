@@ -2,6 +2,11 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <functional>
 #include <memory>
 #include <iostream>
 #include <charconv>
@@ -18,11 +23,7 @@ class Service
 			std::unique_ptr<boost::asio::ip::tcp::socket> sock
 		)
 		{
-			std::thread(
-				&Service::handleClient,
-				std::move(Service::create()),
-				std::move(sock)
-			).detach();
+			Service::create()->handleClient(std::move(sock));
 		}
 	private:
 		Service() = default;
@@ -75,14 +76,190 @@ class Service
 
 };
 
+// Fixed or elastic pool of threads handling accepted clients.
+// Accepted sockets are handed off to workers through the bounded
+// queue. When the queue is full, the overflow policy decides what
+// happens with the next client.
+class WorkerPool
+{
+	public:
+		enum class OverflowPolicy
+		{
+			block,  // Acceptor waits until there is room in the queue.
+			reject, // Client immediately receives "ERROR\n".
+			grow    // Extra worker is started unless there are
+			        // max_workers already, otherwise as block.
+		};
+
+		struct Stats
+		{
+			std::size_t queue_depth;  // Clients waiting for a worker.
+			std::size_t workers;      // Started workers.
+			std::size_t busy_workers; // Workers handling clients.
+			std::size_t rejected;     // Clients rejected on overflow.
+		};
+
+		using Handler =
+			std::function<void (std::unique_ptr<boost::asio::ip::tcp::socket>)>;
+
+		WorkerPool(
+			Handler handler,
+			std::size_t min_workers,
+			std::size_t max_workers,
+			std::size_t queue_capacity,
+			OverflowPolicy policy
+		) :
+		m_handler(std::move(handler)),
+		m_max_workers(std::max(min_workers, max_workers)),
+		m_queue_capacity(queue_capacity),
+		m_policy(policy)
+		{
+			assert(0 < min_workers);
+
+			std::lock_guard lock(m_guard);
+			for (std::size_t i = 0; i != min_workers; ++i)
+				startWorker();
+		}
+
+		~WorkerPool()
+		{
+			stop();
+		}
+
+		// Hands the client off to the workers. Blocks the calling
+		// thread if the queue is full and the policy is block.
+		void submit(std::unique_ptr<boost::asio::ip::tcp::socket> sock)
+		{
+			std::unique_lock lock(m_guard);
+
+			if (
+				m_policy == OverflowPolicy::grow &&
+				m_queue.size() + m_busy_workers >= m_workers.size() &&
+				m_workers.size() < m_max_workers
+			)
+			{
+				// There is no idle worker.
+				startWorker();
+			}
+
+			if (m_queue.size() == m_queue_capacity)
+			{
+				if (m_policy == OverflowPolicy::reject)
+				{
+					++m_rejected;
+					lock.unlock();
+					reject(*sock);
+					return;
+				}
+
+				m_not_full.wait(
+					lock,
+					[this]{ return m_stop || m_queue.size() < m_queue_capacity; }
+				);
+				if (m_stop)
+					return;
+			}
+
+			m_queue.push_back(std::move(sock));
+			m_not_empty.notify_one();
+		}
+
+		// Waits for the workers to handle clients in the queue
+		// and stops them.
+		void stop()
+		{
+			{
+				std::lock_guard lock(m_guard);
+				m_stop = true;
+			}
+			m_not_empty.notify_all();
+			m_not_full.notify_all();
+
+			for (auto &&th : m_workers)
+				if (th.joinable()) th.join();
+		}
+
+		Stats stats()
+		{
+			std::lock_guard lock(m_guard);
+			return Stats{
+				m_queue.size(),
+				m_workers.size(),
+				m_busy_workers,
+				m_rejected
+			};
+		}
+
+	private:
+		// Must be called with m_guard locked.
+		void startWorker()
+		{
+			m_workers.emplace_back(&WorkerPool::run, this);
+		}
+
+		void run()
+		{
+			std::unique_lock lock(m_guard);
+			for (;;)
+			{
+				m_not_empty.wait(
+					lock,
+					[this]{ return m_stop || !m_queue.empty(); }
+				);
+				if (m_queue.empty())
+					return;
+
+				auto sock = std::move(m_queue.front());
+				m_queue.pop_front();
+				++m_busy_workers;
+				m_not_full.notify_one();
+
+				lock.unlock();
+				m_handler(std::move(sock));
+				lock.lock();
+
+				--m_busy_workers;
+			}
+		}
+
+		void static reject(boost::asio::ip::tcp::socket &sock)
+		{
+			// Failure to notify the client doesn't matter,
+			// the connection is closed anyway.
+			boost::system::error_code ignored_ec;
+			boost::asio::write(
+				sock,
+				boost::asio::buffer(std::string_view("ERROR\n")),
+				ignored_ec
+			);
+		}
+
+	private:
+		Handler m_handler;
+		const std::size_t m_max_workers;
+		const std::size_t m_queue_capacity;
+		const OverflowPolicy m_policy;
+
+		std::mutex m_guard;
+		std::condition_variable m_not_empty;
+		std::condition_variable m_not_full;
+		std::deque<std::unique_ptr<boost::asio::ip::tcp::socket>> m_queue;
+		std::vector<std::thread> m_workers;
+		std::size_t m_busy_workers = 0;
+		std::size_t m_rejected = 0;
+		bool m_stop = false;
+};
+
 class Acceptor
 {
 	public:
 		Acceptor(
 			boost::asio::io_context &ioc,
-			std::uint16_t port_num
+			std::uint16_t port_num,
+			WorkerPool &pool
 		) :
 		m_ioc(ioc),
+		m_pool(pool),
 		m_acceptor(
 			m_ioc,
 			boost::asio::ip::tcp::endpoint(
@@ -100,11 +277,12 @@ class Acceptor
 
 			m_acceptor.accept(*sock);
 
-			Service::startHandlingClient(std::move(sock));
+			m_pool.submit(std::move(sock));
 		}
 
 	private:
 		boost::asio::io_context &m_ioc;
+		WorkerPool &m_pool;
 		boost::asio::ip::tcp::acceptor m_acceptor;
 };
 
@@ -126,11 +304,17 @@ class Server
 		{
 			m_stop = true;
 			m_thread.join();
+			m_pool.stop();
+		}
+
+		WorkerPool::Stats stats()
+		{
+			return m_pool.stats();
 		}
 	private:
 		void run(std::uint16_t port_num)
 		{
-			Acceptor acc(m_ioc, port_num);
+			Acceptor acc(m_ioc, port_num, m_pool);
 
 			while (!m_stop)
 			{
@@ -141,6 +325,17 @@ class Server
 		std::thread m_thread;
 		std::atomic<bool> m_stop{false};
 		boost::asio::io_context m_ioc;
+		WorkerPool m_pool{
+			&Service::startHandlingClient,
+			MIN_WORKERS,
+			MAX_WORKERS,
+			QUEUE_CAPACITY,
+			WorkerPool::OverflowPolicy::grow
+		};
+
+		constexpr inline std::size_t static MIN_WORKERS = 8;
+		constexpr inline std::size_t static MAX_WORKERS = 64;
+		constexpr inline std::size_t static QUEUE_CAPACITY = 256;
 };
 
 // Run tcp_asynchronous client from 03_impl_client_apps
@@ -155,6 +350,14 @@ int main()
 		srv.start(port_num);
 
 		std::cin.get();
+
+		auto stats = srv.stats();
+		std::cout << "Queue depth: " << stats.queue_depth
+		<< ", busy workers: " << stats.busy_workers
+		<< '/' << stats.workers
+		<< ", rejected: " << stats.rejected
+		<< '\n';
+
 		srv.stop();
 	}
 	catch (boost::system::system_error &e)
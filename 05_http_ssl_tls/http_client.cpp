@@ -13,14 +13,25 @@
 #endif
 #endif
 
+// Asio 1.74 uses std::exchange in awaitable.hpp without including it.
+#include <utility>
 #include <boost/asio.hpp>
 #include <boost/current_function.hpp>
 
+#include "../common/happy_eyeballs.hpp"
+#include "../common/resolver_cache.hpp"
+#include "../common/simd_read_until.hpp"
+
 #include <thread>
 #include <mutex>
 #include <memory>
 #include <iostream>
 #include <charconv>
+#include <map>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <cstring>
 
 namespace http_errors
 {
@@ -79,11 +90,17 @@ namespace boost::system
 class HTTPClient;
 class HTTPRequest;
 class HTTPResponse;
+class HTTPConnectionPool;
+class HTTPBodyBuffer;
 
 using Callback = std::function<
 	void (const HTTPRequest&,const HTTPResponse&,const boost::system::error_code&)
 >;
 
+using BodyCallback = std::function<
+	void (const HTTPRequest&,HTTPBodyBuffer)
+>;
+
 class HTTPResponse
 {
 	friend class HTTPRequest;
@@ -107,8 +124,41 @@ class HTTPResponse
 		{
 			return m_response_stream;
 		}
+
+		// Value of the header without surrounding whitespace.
+		// Header names are compared case-insensitively.
+		std::optional<std::string_view> find_header(std::string_view name) const
+		{
+			for (auto &&[header_name, header_value] : m_headers)
+			{
+				if (!iequals(header_name, name))
+					continue;
+
+				std::string_view value(header_value);
+				auto first = value.find_first_not_of(" \t");
+				if (first == std::string_view::npos)
+					return std::string_view();
+				auto last = value.find_last_not_of(" \t");
+				return value.substr(first, last - first + 1);
+			}
+			return std::nullopt;
+		}
 	private:
 		HTTPResponse() = default;
+
+		static bool iequals(std::string_view a, std::string_view b)
+		{
+			return std::equal(
+				a.begin(), a.end(),
+				b.begin(), b.end(),
+				[](char l, char r)
+				{
+					return std::tolower(static_cast<unsigned char>(l)) ==
+						std::tolower(static_cast<unsigned char>(r));
+				}
+			);
+		}
+
 		void add_header(const std::string &name, std::string_view value)
 		{
 			m_headers[name] = value;
@@ -128,9 +178,367 @@ class HTTPResponse
 		std::iostream m_response_stream{&m_response_buf};
 };
 
+// Idle keep-alive connections grouped by host and port. Request
+// borrows the connection instead of resolving the host and connecting,
+// and returns it once the whole response has been read. The most
+// recently used connection is borrowed first, connections idle for
+// longer than idle_timeout are closed. Expired connections are swept
+// by the timer, so they are closed even if no more requests are made.
+class HTTPConnectionPool
+{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		HTTPConnectionPool(
+			boost::asio::io_context &ioc,
+			std::size_t max_idle_per_host,
+			clock::duration idle_timeout
+		) :
+		m_max_idle_per_host(max_idle_per_host),
+		m_idle_timeout(idle_timeout),
+		m_sweep_timer(ioc)
+		{}
+
+		std::optional<boost::asio::ip::tcp::socket> acquire(
+			const std::string &host,
+			std::uint16_t port
+		)
+		{
+			std::lock_guard lock(m_guard);
+			auto it = m_idle.find({host, port});
+			if (it == m_idle.end())
+				return std::nullopt;
+
+			auto &&connections = it->second;
+			remove_expired(connections);
+			if (connections.empty())
+				return std::nullopt;
+
+			auto sock = std::move(connections.back().sock);
+			connections.pop_back();
+			return sock;
+		}
+
+		void release(
+			const std::string &host,
+			std::uint16_t port,
+			boost::asio::ip::tcp::socket sock
+		)
+		{
+			std::lock_guard lock(m_guard);
+			if (m_closed)
+				return;
+
+			auto &&connections = m_idle[{host, port}];
+			remove_expired(connections);
+			if (connections.size() == m_max_idle_per_host)
+				connections.erase(connections.begin());
+			connections.push_back({std::move(sock), clock::now()});
+			if (!m_is_sweep_scheduled)
+				schedule_sweep(connections.back().idle_since + m_idle_timeout);
+		}
+
+		void close()
+		{
+			std::lock_guard lock(m_guard);
+			m_closed = true;
+			m_idle.clear();
+			m_sweep_timer.cancel();
+		}
+
+	private:
+		struct IdleConnection
+		{
+			boost::asio::ip::tcp::socket sock;
+			clock::time_point idle_since;
+		};
+
+		// Connections are ordered by the time they became idle.
+		void remove_expired(std::vector<IdleConnection> &connections)
+		{
+			auto deadline = clock::now() - m_idle_timeout;
+			auto it = std::find_if(
+				connections.begin(),
+				connections.end(),
+				[deadline](auto &&c){ return deadline < c.idle_since; }
+			);
+			connections.erase(connections.begin(), it);
+		}
+
+		// Called with m_guard locked.
+		void schedule_sweep(clock::time_point at)
+		{
+			m_is_sweep_scheduled = true;
+			m_sweep_timer.expires_at(at);
+			m_sweep_timer.async_wait(
+				[this](const boost::system::error_code &ec)
+				{
+					sweep(ec);
+				}
+			);
+		}
+
+		// Removes expired connections of all hosts and schedules
+		// the next sweep at the earliest expiry of the rest.
+		void sweep(const boost::system::error_code &ec)
+		{
+			std::lock_guard lock(m_guard);
+			m_is_sweep_scheduled = false;
+			if (ec || m_closed)
+				return;
+
+			std::optional<clock::time_point> next_expiry;
+			for (auto it = m_idle.begin(); it != m_idle.end();)
+			{
+				auto &&connections = it->second;
+				remove_expired(connections);
+				if (connections.empty())
+				{
+					it = m_idle.erase(it);
+					continue;
+				}
+
+				auto expiry = connections.front().idle_since + m_idle_timeout;
+				if (!next_expiry || expiry < *next_expiry)
+					next_expiry = expiry;
+				++it;
+			}
+
+			if (next_expiry)
+				schedule_sweep(*next_expiry);
+		}
+
+	private:
+		const std::size_t m_max_idle_per_host;
+		const clock::duration m_idle_timeout;
+
+		std::mutex m_guard;
+		std::map<
+			std::pair<std::string, std::uint16_t>,
+			std::vector<IdleConnection>
+		> m_idle;
+		bool m_closed = false;
+
+		// Timer operations are made with m_guard locked.
+		boost::asio::steady_timer m_sweep_timer;
+		bool m_is_sweep_scheduled = false;
+};
+
+// Decoder of the chunked transfer coding. Data is decoded in place
+// as it arrives: chunk payload is moved to the front of the received
+// bytes and the framing is dropped. Framing is parsed byte by byte,
+// so it's never buffered, even when split between reads.
+class ChunkedDecoder
+{
+	public:
+		enum class result
+		{
+			good,  // More data is required.
+			done,  // Last chunk and trailers have been decoded.
+			bad    // Framing is invalid.
+		};
+
+		// Decodes size bytes starting at data. Payload is placed at
+		// data, its size is stored in payload_size. Bytes following
+		// the end of the body are left undecoded, their number is
+		// stored in rest_size.
+		result decode(
+			char *data,
+			std::size_t size,
+			std::size_t &payload_size,
+			std::size_t &rest_size
+		)
+		{
+			auto out = data;
+			auto in = data;
+			auto end = data + size;
+			payload_size = rest_size = 0;
+
+			while (in != end && m_state != state::done)
+			{
+				if (m_state == state::data)
+				{
+					auto n = static_cast<std::size_t>(end - in);
+					if (m_remaining < n)
+						n = static_cast<std::size_t>(m_remaining);
+					std::memmove(out, in, n);
+					out += n;
+					in += n;
+					m_remaining -= n;
+					if (!m_remaining)
+						m_state = state::data_cr;
+					continue;
+				}
+
+				if (!consume(*in++))
+					return result::bad;
+			}
+
+			payload_size = static_cast<std::size_t>(out - data);
+			rest_size = static_cast<std::size_t>(end - in);
+			return m_state == state::done ? result::done : result::good;
+		}
+
+	private:
+		enum class state
+		{
+			size,         // Hexadecimal chunk size.
+			extension,    // Chunk extension up to CR, ignored.
+			size_lf,
+			data,
+			data_cr,
+			data_lf,
+			trailer_start,
+			trailer,      // Trailer field up to CR, ignored.
+			trailer_lf,
+			final_lf,
+			done
+		};
+
+		// Consumes the byte of the framing.
+		bool consume(char c)
+		{
+			switch (m_state)
+			{
+				case state::size:
+					if (auto digit = hex_digit(c); digit >= 0)
+					{
+						// Reject sizes which don't fit.
+						if (m_remaining >> 60)
+							return false;
+						m_remaining = m_remaining * 16 + digit;
+						m_has_size = true;
+						return true;
+					}
+					if (!m_has_size)
+						return false;
+					if (c == ';' || c == ' ' || c == '\t')
+						m_state = state::extension;
+					else if (c == '\r')
+						m_state = state::size_lf;
+					else
+						return false;
+					return true;
+				case state::extension:
+					if (c == '\r')
+						m_state = state::size_lf;
+					return true;
+				case state::size_lf:
+					if (c != '\n')
+						return false;
+					m_state = m_remaining ? state::data : state::trailer_start;
+					return true;
+				case state::data_cr:
+					m_state = state::data_lf;
+					return c == '\r';
+				case state::data_lf:
+					m_state = state::size;
+					m_has_size = false;
+					return c == '\n';
+				case state::trailer_start:
+					m_state = c == '\r' ? state::final_lf : state::trailer;
+					return true;
+				case state::trailer:
+					if (c == '\r')
+						m_state = state::trailer_lf;
+					return true;
+				case state::trailer_lf:
+					m_state = state::trailer_start;
+					return c == '\n';
+				case state::final_lf:
+					m_state = state::done;
+					return c == '\n';
+				default:
+					return false;
+			}
+		}
+
+		static int hex_digit(char c)
+		{
+			if ('0' <= c && c <= '9')
+				return c - '0';
+			if ('a' <= c && c <= 'f')
+				return c - 'a' + 10;
+			if ('A' <= c && c <= 'F')
+				return c - 'A' + 10;
+			return -1;
+		}
+
+	private:
+		state m_state = state::size;
+		std::uint64_t m_remaining = 0; // Size of the chunk or its rest.
+		bool m_has_size = false;
+};
+
+// Part of the body handed out in streaming mode. The buffer returns
+// to the request when it's released or destroyed, reading of the
+// body is paused while the user holds all buffers of the window.
+// Buffers must be released before the request is destroyed.
+class HTTPBodyBuffer
+{
+	friend class HTTPRequest;
+	public:
+		HTTPBodyBuffer(HTTPBodyBuffer &&other) noexcept :
+		m_request(std::exchange(other.m_request, nullptr)),
+		m_index(other.m_index),
+		m_data(other.m_data),
+		m_size(other.m_size)
+		{}
+
+		HTTPBodyBuffer &operator=(HTTPBodyBuffer &&other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				m_request = std::exchange(other.m_request, nullptr);
+				m_index = other.m_index;
+				m_data = other.m_data;
+				m_size = other.m_size;
+			}
+			return *this;
+		}
+
+		~HTTPBodyBuffer()
+		{
+			release();
+		}
+
+		const char *get_data() const
+		{
+			return m_data;
+		}
+
+		std::size_t get_size() const
+		{
+			return m_size;
+		}
+
+		// Returns the buffer to the request, it may be called
+		// from any thread.
+		void release();
+	private:
+		HTTPBodyBuffer(
+			HTTPRequest &request,
+			std::size_t index,
+			const char *data,
+			std::size_t size
+		) :
+		m_request(&request),
+		m_index(index),
+		m_data(data),
+		m_size(size)
+		{}
+	private:
+		HTTPRequest *m_request;
+		std::size_t m_index;
+		const char *m_data;
+		std::size_t m_size;
+};
+
 class HTTPRequest
 {
 	friend class HTTPClient;
+	friend class HTTPBodyBuffer;
 	public:
 		void set_host(std::string_view host)
 		{
@@ -148,6 +556,22 @@ class HTTPRequest
 		{
 			m_callback = std::move(callback);
 		}
+		// Streaming mode: the body isn't collected in the response,
+		// it's passed to the callback in buffers of buffer_size bytes
+		// as it arrives. The user holds window bytes at most, reading
+		// is paused until buffers are released. The request callback
+		// is called when the whole body has been handed out.
+		void set_body_callback(
+			BodyCallback callback,
+			std::size_t window = DEFAULT_BODY_WINDOW,
+			std::size_t buffer_size = DEFAULT_BODY_BUFFER_SIZE
+		)
+		{
+			assert(buffer_size != 0 && buffer_size <= window);
+			m_body_callback = std::move(callback);
+			m_body_buffer_size = buffer_size;
+			m_body_buffer_count = window / buffer_size;
+		}
 		std::string_view get_host() const
 		{
 			return m_host;
@@ -164,6 +588,10 @@ class HTTPRequest
 		{
 			return m_id;
 		}
+		const HTTPResponse &get_response() const
+		{
+			return m_response;
+		}
 		void execute()
 		{
 			// Ensure that preconditions hold.
@@ -171,68 +599,117 @@ class HTTPRequest
 			assert(m_host.length());
 			assert(m_uri.length());
 			assert(m_callback);
-			std::string port_str(5,'\0');
-			if (auto [p,er] = std::to_chars(
-					port_str.data(),
-					port_str.data()+port_str.size(),
-					m_port
-				);
-				er == std::errc()
-			)
-			{
-				port_str.resize(p - port_str.data());
-			}
-			else
+
+			if (m_was_cancelled)
 			{
-				on_finish(http_errors::invalid_response);
+				on_finish(boost::asio::error::operation_aborted);
 				return;
 			}
 
-			
-			if (m_was_cancelled)
+			// Borrow the idle connection to the host if there is one.
+			if (auto sock = m_pool.acquire(m_host, m_port))
 			{
-				on_finish(boost::asio::error::operation_aborted);
+				m_sock = std::move(*sock);
+				m_is_reused_connection = true;
+				send_request();
 				return;
 			}
 
-			// Resolve the host name.
-			m_resolver.async_resolve(
-				m_host,
-				port_str,
-				boost::asio::ip::tcp::resolver::numeric_service,
-				[this](auto &&ec, auto &&it)
+			resolve_host();
+		}
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+		// Awaitable form of execute(), it's available when the
+		// example is compiled as C++20. Completes when the response
+		// has been received, it's accessed with get_response().
+		// Throws boost::system::system_error if the request fails.
+		// Asio 1.74 has no cancellation slots, the request is
+		// cancelled with cancel() as before.
+		boost::asio::awaitable<void> async_execute()
+		{
+			return boost::asio::async_initiate<
+				const boost::asio::use_awaitable_t<>&,
+				void (boost::system::error_code)
+			>(
+				[this](auto handler)
 				{
-					on_host_name_resolved(
-						std::forward<decltype(ec)>(ec),
-						std::forward<decltype(it)>(it)
-					);
-				}
+					// Callback must be copyable, the handler isn't.
+					auto shared_handler =
+						std::make_shared<decltype(handler)>(std::move(handler));
+
+					// Keeps the executor of the coroutine running
+					// while the request is in flight.
+					auto work = boost::asio::make_work_guard(*shared_handler);
+					m_callback = [shared_handler, work](
+						auto &&request,
+						auto &&response,
+						const boost::system::error_code &ec
+					) mutable
+					{
+						// Resume the coroutine on its own executor.
+						boost::asio::dispatch(
+							work.get_executor(),
+							[shared_handler, ec]
+							{
+								(*shared_handler)(ec);
+							}
+						);
+						work.reset();
+					};
+					execute();
+				},
+				boost::asio::use_awaitable
 			);
 		}
+#endif
 
 		void cancel()
 		{
 			m_was_cancelled = true;
-			m_resolver.cancel();
+			m_connector.cancel();
 			if (m_sock.is_open())
 			{
 				m_sock.cancel();
 			}
+
+			// Nothing is read while the body is paused, reading is
+			// resumed to complete the request.
+			resume_body();
 		}
 	private:
 		HTTPRequest(
 			boost::asio::io_context &ioc,
+			HTTPConnectionPool &pool,
 			std::size_t id
 		) :
 		m_id(id),
 		m_sock(ioc),
-		m_resolver(ioc),
-		m_ioc(ioc)
+		m_connector(ioc.get_executor()),
+		m_ioc(ioc),
+		m_pool(pool)
 		{}
 
+		// Lookups of the host are shared with other requests, a
+		// lookup in flight isn't cancelled.
+		void resolve_host()
+		{
+			ResolverCache::getInstance().asyncResolve<boost::asio::ip::tcp>(
+				m_ioc.get_executor(),
+				m_host,
+				m_port,
+				[this](auto &&ec, auto &&endpoints)
+				{
+					on_host_name_resolved(
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(endpoints)>(endpoints)
+					);
+				}
+			);
+		}
+
 		void on_host_name_resolved(
 			const boost::system::error_code &ec,
-			boost::asio::ip::tcp::resolver::iterator it
+			std::vector<boost::asio::ip::tcp::endpoint> endpoints
 		)
 		{
 			if (!ec)
@@ -243,16 +720,17 @@ class HTTPRequest
 					return;
 				}
 
-				// Connect to the host.
-				boost::asio::async_connect(
+				// Connect to the host. Addresses are raced, so
+				// the dead one doesn't hold the connection up.
+				m_connector.asyncConnect(
 					m_sock,
-					it,
-					[this](auto &&ec, auto &&it)
+					std::move(endpoints),
+					[this](
+						const boost::system::error_code &ec,
+						const boost::asio::ip::tcp::endpoint &ep
+					)
 					{
-						on_connection_established(
-							std::forward<decltype(ec)>(ec),
-							std::forward<decltype(it)>(it)
-						);
+						on_connection_established(ec, ep);
 					}
 				);
 
@@ -263,38 +741,63 @@ class HTTPRequest
 
 		void on_connection_established(
 			const boost::system::error_code &ec,
-			boost::asio::ip::tcp::resolver::iterator it
+			const boost::asio::ip::tcp::endpoint &ep
 		)
 		{
 			if (!ec)
 			{
-				m_request_buf = 
-					"GET " + m_uri + " HTTP/1.1\r\n" +
-					"HOST: " + m_host + "\r\n" +
-					"\r\n";
-				
-				if (m_was_cancelled)
+				send_request();
+				return;
+			}
+			on_finish(ec);
+		}
+
+		void send_request()
+		{
+			m_request_buf = 
+				"GET " + m_uri + " HTTP/1.1\r\n" +
+				"HOST: " + m_host + "\r\n" +
+				"Connection: keep-alive\r\n" +
+				"\r\n";
+			
+			if (m_was_cancelled)
+			{
+				on_finish(boost::asio::error::operation_aborted);
+				return;
+			}
+
+			// Send the request message.
+			boost::asio::async_write(
+				m_sock,
+				boost::asio::buffer(m_request_buf),
+				[this](auto &&ec, auto &&bt)
 				{
-					on_finish(boost::asio::error::operation_aborted);
-					return;
+					on_request_sent(
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(bt)>(bt)
+					);
 				}
+			);
+		}
 
-				// Send the request message.
-				boost::asio::async_write(
-					m_sock,
-					boost::asio::buffer(m_request_buf),
-					[this](auto &&ec, auto &&bt)
-					{
-						on_request_sent(
-							std::forward<decltype(ec)>(ec),
-							std::forward<decltype(bt)>(bt)
-						);
-					}
-				);
+		// Server may have closed the borrowed connection while it was
+		// idle. Request which has got nothing over it is retried
+		// over the new connection.
+		bool retry_over_new_connection(const boost::system::error_code &ec)
+		{
+			if (
+				!ec ||
+				!m_is_reused_connection ||
+				m_response.m_response_buf.size() ||
+				m_was_cancelled
+			)
+				return false;
 
-				return;
-			}
-			on_finish(ec);
+			m_is_reused_connection = false;
+			boost::system::error_code ignored_ec;
+			m_sock.close(ignored_ec);
+			resolve_host();
+			return true;
 		}
 
 		void on_request_sent(
@@ -302,10 +805,11 @@ class HTTPRequest
 			std::size_t bytes_transferred
 		)
 		{
+			if (retry_over_new_connection(ec))
+				return;
+
 			if (!ec)
 			{
-				m_sock.shutdown(boost::asio::ip::tcp::socket::shutdown_send);
-				
 				if (m_was_cancelled)
 				{
 					on_finish(boost::asio::error::operation_aborted);
@@ -313,7 +817,7 @@ class HTTPRequest
 				}
 
 				// Read the status line.
-				boost::asio::async_read_until(
+				simd::async_read_until(
 					m_sock,
 					m_response.m_response_buf,
 					"\r\n",
@@ -336,6 +840,9 @@ class HTTPRequest
 			std::size_t bytes_transferred
 		)
 		{
+			if (retry_over_new_connection(ec))
+				return;
+
 			if (!ec)
 			{
 				// Parse the status line.
@@ -387,7 +894,7 @@ class HTTPRequest
 				// At this point the status line is successfully
 				// received and parsed.
 				// Now read the response headers.
-				boost::asio::async_read_until(
+				simd::async_read_until(
 					m_sock,
 					m_response.m_response_buf,
 					"\r\n\r\n",
@@ -418,9 +925,9 @@ class HTTPRequest
 				auto &&response_stream = m_response.m_response_stream;
 				while (std::getline(response_stream, header, '\r'))
 				{
-					if (header.empty()) break;
 					// Remove '\n' symbol from the stream.
 					response_stream.get();
+					if (header.empty()) break;
 
 					auto separator_pos = header.find(':');
 					if (separator_pos != std::string::npos)
@@ -445,32 +952,397 @@ class HTTPRequest
 					return;
 				}
 
-				boost::asio::async_read(
-					m_sock,
-					m_response.m_response_buf,
-					[this](auto &&ec, auto &&bt)
-					{
-						on_response_body_received(
-							std::forward<decltype(ec)>(ec),
-							std::forward<decltype(bt)>(bt)
-						);
-					}
-				);
-
+				read_response_body();
 				return;
 			}
 			on_finish(ec);
 		}
 
+		// Body is delimited by the chunked transfer coding or by
+		// Content-Length, the connection is returned to the pool after
+		// it has been read. Body of unknown length lasts until the
+		// server closes the connection.
+		void read_response_body()
+		{
+			auto connection = m_response.find_header("connection");
+			m_keep_alive = !connection || !HTTPResponse::iequals(*connection, "close");
+
+			if (!select_body_framing())
+			{
+				on_finish(http_errors::invalid_response);
+				return;
+			}
+
+			if (m_body_callback)
+			{
+				start_body_stream();
+				return;
+			}
+
+			switch (m_body_framing)
+			{
+				case body_framing::chunked:
+					start_chunked_body();
+					return;
+				case body_framing::until_eof:
+					read_body_until_eof();
+					return;
+				default:
+					break;
+			}
+
+			auto received = m_response.m_response_buf.size();
+			if (m_body_remaining <= received)
+			{
+				// Bytes after the body aren't expected, the
+				// connection isn't reused if there are any. They
+				// are dropped: the body is moved to the back of the
+				// received bytes and those ahead of it are consumed.
+				if (m_body_remaining < received)
+				{
+					m_keep_alive = false;
+
+					auto &&buf = m_response.m_response_buf;
+					auto data = const_cast<char*>(
+						static_cast<const char*>(buf.data().data())
+					);
+					auto body_size = static_cast<std::size_t>(m_body_remaining);
+					if (body_size)
+						std::memmove(data + received - body_size, data, body_size);
+					buf.consume(received - body_size);
+				}
+				on_response_body_received(boost::system::error_code(), 0);
+				return;
+			}
+
+			boost::asio::async_read(
+				m_sock,
+				m_response.m_response_buf,
+				boost::asio::transfer_exactly(m_body_remaining - received),
+				[this](auto &&ec, auto &&bt)
+				{
+					on_response_body_received(
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(bt)>(bt)
+					);
+				}
+			);
+		}
+
+		// Returns false if Content-Length can't be parsed.
+		bool select_body_framing()
+		{
+			auto status_code = m_response.m_status_code;
+			bool has_no_body =
+				(100 <= status_code && status_code < 200) ||
+				status_code == 204 ||
+				status_code == 304;
+
+			m_body_remaining = 0;
+			m_body_framing = body_framing::content_length;
+			if (has_no_body)
+				return true;
+
+			if (auto header = m_response.find_header("transfer-encoding"))
+			{
+				// Chunked coding is the last one applied, if it isn't
+				// there the body lasts until EOF.
+				auto coding = header->substr(header->rfind(',') + 1);
+				coding.remove_prefix(std::min(coding.find_first_not_of(" \t"), coding.size()));
+				if (HTTPResponse::iequals(coding, "chunked"))
+				{
+					m_body_framing = body_framing::chunked;
+					return true;
+				}
+			}
+			else if (auto header = m_response.find_header("content-length"))
+			{
+				return std::from_chars(
+					header->data(),
+					header->data() + header->size(),
+					m_body_remaining
+				).ec == std::errc();
+			}
+
+			m_body_framing = body_framing::until_eof;
+			m_keep_alive = false;
+			return true;
+		}
+
+		void read_body_until_eof()
+		{
+			boost::asio::async_read(
+				m_sock,
+				m_response.m_response_buf,
+				[this](auto &&ec, auto &&bt)
+				{
+					on_response_body_received(
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(bt)>(bt)
+					);
+				}
+			);
+		}
+
+		void start_chunked_body()
+		{
+			// Bytes received with the headers are decoded in place.
+			// Input sequence of the streambuf is contiguous and its
+			// storage is writable. Payload is moved from the front of
+			// the decoded bytes to their back, the rest is consumed.
+			auto &&buf = m_response.m_response_buf;
+			auto data = const_cast<char*>(
+				static_cast<const char*>(buf.data().data())
+			);
+			auto size = buf.size();
+
+			std::size_t payload_size = 0;
+			std::size_t rest_size = 0;
+			auto result = m_chunked_decoder.decode(
+				data,
+				size,
+				payload_size,
+				rest_size
+			);
+			if (payload_size && payload_size != size)
+				std::memmove(data + size - payload_size, data, payload_size);
+			buf.consume(size - payload_size);
+			on_chunked_body_decoded(result, rest_size);
+		}
+
+		void read_chunked_body()
+		{
+			if (m_was_cancelled)
+			{
+				on_finish(boost::asio::error::operation_aborted);
+				return;
+			}
+
+			// Data is read straight into the free space of the
+			// response buffer and decoded there.
+			m_read_area = m_response.m_response_buf.prepare(CHUNKED_READ_SIZE);
+			m_sock.async_read_some(
+				m_read_area,
+				[this](auto &&ec, auto &&bt)
+				{
+					on_chunked_body_part_received(
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(bt)>(bt)
+					);
+				}
+			);
+		}
+
+		void on_chunked_body_part_received(
+			const boost::system::error_code &ec,
+			std::size_t bytes_transferred
+		)
+		{
+			if (ec)
+			{
+				on_finish(ec);
+				return;
+			}
+
+			std::size_t payload_size = 0;
+			std::size_t rest_size = 0;
+			auto result = m_chunked_decoder.decode(
+				static_cast<char*>(m_read_area.data()),
+				bytes_transferred,
+				payload_size,
+				rest_size
+			);
+			m_response.m_response_buf.commit(payload_size);
+			on_chunked_body_decoded(result, rest_size);
+		}
+
+		void on_chunked_body_decoded(ChunkedDecoder::result result, std::size_t rest_size)
+		{
+			switch (result)
+			{
+				case ChunkedDecoder::result::good:
+					read_chunked_body();
+					return;
+				case ChunkedDecoder::result::done:
+					// Bytes after the body aren't expected, the
+					// connection isn't reused if there are any.
+					if (rest_size)
+						m_keep_alive = false;
+					on_response_body_received(boost::system::error_code(), 0);
+					return;
+				default:
+					on_finish(http_errors::invalid_response);
+					return;
+			}
+		}
+
+		// Body is read into buffers of the window one after another,
+		// every buffer is handed out as soon as it has got data.
+		void start_body_stream()
+		{
+			if (!m_body_memory)
+			{
+				m_body_memory.reset(new char[m_body_buffer_count * m_body_buffer_size]);
+				m_free_body_buffers.reserve(m_body_buffer_count);
+				for (auto i = m_body_buffer_count; i != 0; --i)
+					m_free_body_buffers.push_back(i - 1);
+			}
+
+			if (m_body_framing == body_framing::content_length && !m_body_remaining)
+			{
+				if (m_response.m_response_buf.size())
+					m_keep_alive = false;
+				on_response_body_received(boost::system::error_code(), 0);
+				return;
+			}
+
+			read_body_part();
+		}
+
+		void read_body_part()
+		{
+			if (m_was_cancelled)
+			{
+				on_finish(boost::asio::error::operation_aborted);
+				return;
+			}
+
+			{
+				std::lock_guard lock(m_body_guard);
+				if (m_free_body_buffers.empty())
+				{
+					m_is_body_paused = true;
+					return;
+				}
+				m_body_buffer = m_free_body_buffers.back();
+				m_free_body_buffers.pop_back();
+			}
+
+			auto size = m_body_buffer_size;
+			if (m_body_framing == body_framing::content_length && m_body_remaining < size)
+				size = m_body_remaining;
+			auto buffer = boost::asio::buffer(get_body_buffer(m_body_buffer), size);
+
+			// Bytes received with the headers go first.
+			if (auto &&buf = m_response.m_response_buf; buf.size())
+			{
+				auto n = boost::asio::buffer_copy(buffer, buf.data());
+				buf.consume(n);
+				on_body_part_received(boost::system::error_code(), n);
+				return;
+			}
+
+			m_sock.async_read_some(
+				buffer,
+				[this](auto &&ec, auto &&bt)
+				{
+					on_body_part_received(
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(bt)>(bt)
+					);
+				}
+			);
+		}
+
+		void on_body_part_received(
+			const boost::system::error_code &ec,
+			std::size_t bytes_transferred
+		)
+		{
+			auto data = get_body_buffer(m_body_buffer);
+			auto size = bytes_transferred;
+			bool is_done = false;
+
+			if (ec)
+			{
+				if (m_body_framing != body_framing::until_eof || ec != boost::asio::error::eof)
+				{
+					release_body_buffer(m_body_buffer);
+					on_finish(ec);
+					return;
+				}
+				is_done = true;
+			}
+			else if (m_body_framing == body_framing::chunked)
+			{
+				std::size_t rest_size = 0;
+				auto result = m_chunked_decoder.decode(data, bytes_transferred, size, rest_size);
+				if (result == ChunkedDecoder::result::bad)
+				{
+					release_body_buffer(m_body_buffer);
+					on_finish(http_errors::invalid_response);
+					return;
+				}
+				is_done = result == ChunkedDecoder::result::done;
+				if (rest_size)
+					m_keep_alive = false;
+			}
+			else if (m_body_framing == body_framing::content_length)
+			{
+				m_body_remaining -= bytes_transferred;
+				is_done = !m_body_remaining;
+			}
+
+			if (size)
+				m_body_callback(*this, HTTPBodyBuffer(*this, m_body_buffer, data, size));
+			else
+				release_body_buffer(m_body_buffer);
+
+			if (!is_done)
+			{
+				read_body_part();
+				return;
+			}
+
+			// Bytes after the body aren't expected, the
+			// connection isn't reused if there are any.
+			if (m_response.m_response_buf.size())
+				m_keep_alive = false;
+			on_response_body_received(boost::system::error_code(), 0);
+		}
+
+		char *get_body_buffer(std::size_t index)
+		{
+			return m_body_memory.get() + index * m_body_buffer_size;
+		}
+
+		// Called by HTTPBodyBuffer on any thread.
+		void release_body_buffer(std::size_t index)
+		{
+			{
+				std::lock_guard lock(m_body_guard);
+				m_free_body_buffers.push_back(index);
+			}
+			resume_body();
+		}
+
+		void resume_body()
+		{
+			{
+				std::lock_guard lock(m_body_guard);
+				if (!std::exchange(m_is_body_paused, false))
+					return;
+			}
+			boost::asio::post(m_ioc, [this]{ read_body_part(); });
+		}
+
 		void on_response_body_received(
 			const boost::system::error_code &ec,
 			std::size_t bytes_transferred
 		)
 		{
-			if (ec == boost::asio::error::eof)
+			if (m_body_framing == body_framing::until_eof && ec == boost::asio::error::eof)
+			{
 				on_finish(boost::system::error_code());
-			else
-				on_finish(ec);
+				return;
+			}
+
+			if (!ec && m_keep_alive && !m_was_cancelled)
+			{
+				m_pool.release(m_host, m_port, std::move(m_sock));
+				m_sock = boost::asio::ip::tcp::socket(m_ioc);
+			}
+			on_finish(ec);
 		}
 
 		void on_finish(const boost::system::error_code &ec)
@@ -494,25 +1366,78 @@ class HTTPRequest
 		std::string m_request_buf;
 
 		boost::asio::ip::tcp::socket m_sock;
-		boost::asio::ip::tcp::resolver m_resolver;
+		HappyEyeballsConnector<boost::asio::ip::tcp> m_connector;
 
 		HTTPResponse m_response;
 
 		std::atomic<bool> m_was_cancelled{false};
 
+		// Default window of the streaming mode.
+		constexpr inline static std::size_t DEFAULT_BODY_WINDOW = 256 * 1024;
+		constexpr inline static std::size_t DEFAULT_BODY_BUFFER_SIZE = 16 * 1024;
+
+		enum class body_framing
+		{
+			content_length,
+			chunked,
+			until_eof
+		};
+		body_framing m_body_framing = body_framing::content_length;
+		std::size_t m_body_remaining = 0;
+
+		// Chunked body is decoded in place in the response buffer.
+		constexpr inline static std::size_t CHUNKED_READ_SIZE = 16 * 1024;
+		ChunkedDecoder m_chunked_decoder;
+		boost::asio::mutable_buffer m_read_area;
+
+		// Connection has been borrowed from the pool.
+		bool m_is_reused_connection = false;
+		// Connection can be returned to the pool.
+		bool m_keep_alive = false;
+
+		// Streaming mode. Buffers of the window are allocated
+		// together, free ones are referred to by their indices.
+		BodyCallback m_body_callback;
+		std::size_t m_body_buffer_size = 0;
+		std::size_t m_body_buffer_count = 0;
+		std::unique_ptr<char[]> m_body_memory;
+		std::size_t m_body_buffer = 0; // Buffer being filled.
+		std::mutex m_body_guard;
+		std::vector<std::size_t> m_free_body_buffers;
+		bool m_is_body_paused = false;
+
 		boost::asio::io_context &m_ioc;
+		HTTPConnectionPool &m_pool;
 };
 
+inline void HTTPBodyBuffer::release()
+{
+	if (m_request)
+		std::exchange(m_request, nullptr)->release_body_buffer(m_index);
+}
+
 class HTTPClient
 {
 	public:
+		// At most max_idle_per_host keep-alive connections to every
+		// host are kept open for idle_timeout after their last use.
+		explicit HTTPClient(
+			std::size_t max_idle_per_host = 8,
+			std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30)
+		) :
+		m_pool(m_ioc, max_idle_per_host, idle_timeout)
+		{}
+
 		std::unique_ptr<HTTPRequest> create_request(std::size_t id)
 		{
-			return std::unique_ptr<HTTPRequest>(new HTTPRequest(m_ioc, id));
+			return std::unique_ptr<HTTPRequest>(new HTTPRequest(m_ioc, m_pool, id));
 		}
 
 		void close()
 		{
+			// Close idle connections.
+			m_pool.close();
+
 			// Destroy the work
 			m_work.reset();
 
@@ -524,6 +1449,8 @@ class HTTPClient
 		using work_guard = 
 			boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
 		boost::asio::io_context m_ioc;
+		// Idle sockets are destroyed before the io_context.
+		HTTPConnectionPool m_pool;
 		work_guard m_work = boost::asio::make_work_guard(m_ioc);
 		std::thread m_thread{[this]{ m_ioc.run(); }};
 };
@@ -594,6 +1521,37 @@ int main()
 
 		request_thr->execute();
 
+		// Body of this one is streamed instead of being collected.
+		std::size_t body_size = 0;
+		auto request_four = client.create_request(4);
+		request_four->set_host("127.0.0.1");
+		request_four->set_uri("/index.html");
+		request_four->set_port(80);
+		request_four->set_body_callback(
+			[&body_size](const HTTPRequest&, HTTPBodyBuffer buffer)
+			{
+				// Buffer is released when it goes out of scope.
+				body_size += buffer.get_size();
+			}
+		);
+		request_four->set_callback(
+			[&body_size](
+				const HTTPRequest &request,
+				const HTTPResponse &response,
+				const boost::system::error_code &ec
+			)
+			{
+				if (!ec)
+					std::cout << "Request #" << request.get_id()
+					<< " has streamed " << body_size << " bytes."
+					<< std::endl;
+				else
+					handle(request, response, ec);
+			}
+		);
+
+		request_four->execute();
+
 		// Do nothing until enter pressed
 		std::cin.get();
 
@@ -1,12 +1,411 @@
 #include <boost/asio.hpp>
 
+#include "../common/simd_read_until.hpp"
+
 #include <filesystem>
 #include <fstream>
 #include <atomic>
 #include <thread>
+#include <vector>
+#include <mutex>
+#include <list>
+#include <unordered_map>
 #include <iostream>
 #include <array>
 #include <charconv>
+#include <cctype>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Process-wide cache of small static resources.
+// Resources are kept as immutable ref-counted objects, so a service
+// can send the cached body while the entry is being evicted or
+// replaced by the fresh one. The cache is split into shards
+// guarded by their own mutexes to keep I/O threads from
+// contending on a single lock. Every shard evicts least
+// recently used entries when it exceeds its part of the budget.
+class ResourceCache
+{
+	public:
+		struct Resource
+		{
+			std::string path;       // Path of the file on the disk.
+			std::string headers;    // Prebuilt "content-length" header.
+			std::vector<char> body; // Contents of the file.
+			std::filesystem::file_time_type mtime;
+		};
+
+		using resource_ptr = std::shared_ptr<const Resource>;
+
+		static ResourceCache &instance()
+		{
+			static ResourceCache cache;
+			return cache;
+		}
+
+		// Sets the budget of the whole cache in bytes.
+		void set_capacity(std::size_t capacity)
+		{
+			for (auto &&shard : m_shards)
+			{
+				std::lock_guard lock(shard.guard);
+				shard.capacity = capacity / m_shards.size();
+				shard.evict();
+			}
+		}
+
+		// Returns the resource cached with the key if the file
+		// hasn't been modified since it was loaded. The file is
+		// checked at most once per REVALIDATION_PERIOD, so hot
+		// resources are returned without touching the filesystem.
+		resource_ptr find(const std::string &key)
+		{
+			auto &&shard = get_shard(key);
+			std::lock_guard lock(shard.guard);
+
+			auto it = shard.entries.find(key);
+			if (it == shard.entries.end())
+				return {};
+
+			auto &&entry = *it->second;
+			auto now = std::chrono::steady_clock::now();
+			if (REVALIDATION_PERIOD < now - entry.checked_at)
+			{
+				std::error_code ec;
+				auto mtime = std::filesystem::last_write_time(
+					entry.resource->path,
+					ec
+				);
+				if (ec || mtime != entry.resource->mtime)
+				{
+					// Cached resource is stale.
+					shard.erase(it);
+					return {};
+				}
+				entry.checked_at = now;
+			}
+
+			// Mark the entry as most recently used.
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return entry.resource;
+		}
+
+		void insert(const std::string &key, resource_ptr resource)
+		{
+			auto &&shard = get_shard(key);
+			auto size = key.size() +
+				resource->headers.size() +
+				resource->body.size();
+
+			std::lock_guard lock(shard.guard);
+			if (shard.capacity < size)
+				return;
+
+			if (auto it = shard.entries.find(key); it != shard.entries.end())
+				shard.erase(it);
+
+			shard.lru.push_front(
+				Entry{
+					key,
+					std::move(resource),
+					size,
+					std::chrono::steady_clock::now()
+				}
+			);
+			shard.entries.emplace(key, shard.lru.begin());
+			shard.size += size;
+			shard.evict();
+		}
+
+	private:
+		ResourceCache()
+		{
+			set_capacity(DEFAULT_CAPACITY);
+		}
+
+		struct Entry
+		{
+			std::string key;
+			resource_ptr resource;
+			std::size_t size;
+			std::chrono::steady_clock::time_point checked_at;
+		};
+
+		struct Shard
+		{
+			using lru_list = std::list<Entry>;
+
+			void erase(std::unordered_map<std::string, lru_list::iterator>::iterator it)
+			{
+				size -= it->second->size;
+				lru.erase(it->second);
+				entries.erase(it);
+			}
+
+			// Drops least recently used entries until
+			// the shard fits into its budget.
+			void evict()
+			{
+				while (capacity < size)
+					erase(entries.find(lru.back().key));
+			}
+
+			std::mutex guard;
+			lru_list lru; // Most recently used entry is the first.
+			std::unordered_map<std::string, lru_list::iterator> entries;
+			std::size_t size = 0;
+			std::size_t capacity = 0;
+		};
+
+		Shard &get_shard(const std::string &key)
+		{
+			return m_shards[std::hash<std::string>{}(key) % m_shards.size()];
+		}
+
+	private:
+		constexpr inline std::size_t static DEFAULT_CAPACITY = 64 * 1024 * 1024;
+		constexpr inline std::chrono::seconds static REVALIDATION_PERIOD{1};
+
+		std::array<Shard, 16> m_shards;
+};
+
+// Process-wide cache of index files of directories.
+// Result of the directory scan is kept along with the modification
+// time of the directory. Adding, removing or renaming of a file
+// changes the directory mtime, so the directory is scanned once
+// per change and every other lookup costs a single stat call.
+class DirectoryIndexCache
+{
+	public:
+		static DirectoryIndexCache &instance()
+		{
+			static DirectoryIndexCache cache;
+			return cache;
+		}
+
+		// Returns path of the index file of the directory
+		// or empty string if there is no index file.
+		std::string find(const std::string &directory)
+		{
+			std::error_code ec;
+			auto mtime = std::filesystem::last_write_time(directory, ec);
+			if (ec)
+				return {};
+
+			{
+				std::lock_guard lock(m_guard);
+				if (
+					auto it = m_entries.find(directory);
+					it != m_entries.end() && it->second.mtime == mtime
+				)
+					return it->second.index_path;
+			}
+
+			// Scan the directory without holding the lock.
+			std::string index_path;
+			for (auto &de : std::filesystem::directory_iterator(directory, ec))
+			{
+				if (de.is_regular_file(ec))
+				{
+					auto &&path = de.path().generic_string();
+					auto &&filename = de.path().filename().generic_string();
+					if (!filename.find("index"))
+						index_path = path;
+				}
+			}
+
+			std::lock_guard lock(m_guard);
+			m_entries[directory] = Entry{mtime, index_path};
+			return index_path;
+		}
+
+	private:
+		DirectoryIndexCache() = default;
+
+		struct Entry
+		{
+			std::filesystem::file_time_type mtime;
+			std::string index_path;
+		};
+
+	private:
+		std::mutex m_guard;
+		std::unordered_map<std::string, Entry> m_entries;
+};
+
+// Incremental parser of HTTP request head.
+// Parser works right on the bytes of the receive buffer and
+// doesn't allocate memory: request line parts and headers are
+// string views into the buffer, headers are stored in the fixed
+// size array. When the head has arrived partially, the next call
+// continues the search of its end from the place where the
+// previous call stopped.
+class HTTPRequestParser
+{
+	public:
+		enum class result
+		{
+			complete,    // Whole request head is parsed.
+			incomplete,  // More data is needed.
+			bad_request  // Request head is malformed.
+		};
+
+		struct Header
+		{
+			std::string_view name;
+			std::string_view value;
+		};
+
+		// Data must begin with the first byte of the request and
+		// contain all bytes passed to the previous calls.
+		result parse(std::string_view data)
+		{
+			constexpr std::string_view head_end = "\r\n\r\n";
+			auto scan_from = m_scan_pos < head_end.size() ?
+				0 : m_scan_pos - (head_end.size() - 1);
+			auto found = simd::find(
+				data.data() + std::min(scan_from, data.size()),
+				data.data() + data.size(),
+				head_end
+			);
+			if (found == data.data() + data.size())
+			{
+				m_scan_pos = data.size();
+				return result::incomplete;
+			}
+			auto pos = static_cast<std::size_t>(found - data.data());
+			m_head_size = pos + head_end.size();
+
+			// Parse the request line.
+			auto head = data.substr(0, pos + 2);
+			auto line_end = head.find("\r\n");
+			auto line = head.substr(0, line_end);
+			head.remove_prefix(line_end + 2);
+
+			auto method_end = line.find(' ');
+			auto target_end = line.find(' ', method_end + 1);
+			if (
+				method_end == std::string_view::npos ||
+				target_end == std::string_view::npos
+			)
+				return result::bad_request;
+
+			m_method = line.substr(0, method_end);
+			m_target = line.substr(method_end + 1, target_end - method_end - 1);
+			m_version = line.substr(target_end + 1);
+			if (m_method.empty() || m_target.empty() || m_version.empty())
+				return result::bad_request;
+
+			// Parse headers.
+			m_headers_count = 0;
+			while (!head.empty())
+			{
+				line_end = head.find("\r\n");
+				line = head.substr(0, line_end);
+				head.remove_prefix(line_end + 2);
+
+				auto separator_pos = line.find(':');
+				if (
+					separator_pos == 0 ||
+					separator_pos == std::string_view::npos ||
+					m_headers_count == m_headers.size()
+				)
+					return result::bad_request;
+
+				m_headers[m_headers_count++] = Header{
+					line.substr(0, separator_pos),
+					trim(line.substr(separator_pos + 1))
+				};
+			}
+
+			return result::complete;
+		}
+
+		// Prepares the parser for the next request.
+		void reset()
+		{
+			m_scan_pos = 0;
+			m_head_size = 0;
+			m_headers_count = 0;
+		}
+
+		std::string_view method() const
+		{
+			return m_method;
+		}
+
+		std::string_view target() const
+		{
+			return m_target;
+		}
+
+		std::string_view version() const
+		{
+			return m_version;
+		}
+
+		// Size of the parsed request head including
+		// the closing empty line.
+		std::size_t head_size() const
+		{
+			return m_head_size;
+		}
+
+		// Header names are case-insensitive.
+		const Header *find_header(std::string_view name) const
+		{
+			for (std::size_t i = 0; i != m_headers_count; ++i)
+				if (iequals(m_headers[i].name, name))
+					return &m_headers[i];
+			return nullptr;
+		}
+
+		bool static iequals(std::string_view lhs, std::string_view rhs)
+		{
+			if (lhs.size() != rhs.size())
+				return false;
+
+			for (std::size_t i = 0; i != lhs.size(); ++i)
+				if (
+					std::tolower(static_cast<unsigned char>(lhs[i])) !=
+					std::tolower(static_cast<unsigned char>(rhs[i]))
+				)
+					return false;
+			return true;
+		}
+
+	private:
+		std::string_view static trim(std::string_view str)
+		{
+			constexpr std::string_view spaces = " \t";
+			auto first = str.find_first_not_of(spaces);
+			if (first == std::string_view::npos)
+				return {};
+			auto last = str.find_last_not_of(spaces);
+			return str.substr(first, last - first + 1);
+		}
+
+	private:
+		constexpr inline std::size_t static MAX_HEADERS = 32;
+
+		std::size_t m_scan_pos = 0;  // Bytes already searched for head end.
+		std::size_t m_head_size = 0;
+
+		std::string_view m_method;
+		std::string_view m_target;
+		std::string_view m_version;
+
+		std::array<Header, MAX_HEADERS> m_headers;
+		std::size_t m_headers_count = 0;
+};
 
 class Service
 {
@@ -22,21 +421,7 @@ class Service
 					std::move(sock_uptr)
 				)
 			);
-			auto &&sock = *service->m_sock;
-			auto &&request = service->m_request;
-			boost::asio::async_read_until(
-				sock,
-				request,
-				"\r\n",
-				[svc=std::move(service)](auto &&ec, auto &&bt) mutable
-				{
-					Service::on_request_received(
-						std::move(svc),
-						std::forward<decltype(ec)>(ec),
-						std::forward<decltype(bt)>(bt)
-					);
-				}
-			);
+			read_request(std::move(service));
 		}
 
 	private:
@@ -48,83 +433,78 @@ class Service
 		m_sock(std::move(sock))
 		{}
 
-		void static on_request_received(
-			std::unique_ptr<Service> &&service,
-			const boost::system::error_code &ec,
-			std::size_t bytes_transferred
+	public:
+		~Service()
+		{
+			close_file();
+		}
+
+	private:
+
+		// Starts handling of the next request on the connection.
+		// Bytes of pipelined requests which have been already
+		// received stay in m_request_buf, so they are parsed
+		// without reading the socket and requests are served
+		// strictly in the order they were sent.
+		void static read_request(
+			std::unique_ptr<Service> service
 		)
 		{
-			if (!ec)
+			auto &&request_buf = service->m_request_buf;
+			std::string_view data(
+				request_buf.data() + service->m_request_begin,
+				service->m_request_end - service->m_request_begin
+			);
+
+			switch (service->m_parser.parse(data))
 			{
-				// Parse the request line
-				std::string request_line;
-				std::istream request_stream(&service->m_request);
-				std::getline(request_stream, request_line, '\r');
-				// Remove symbol '\n' from the buffer.
-				request_stream.get();
-
-				// Parse the request line.
-				std::string request_method;
-				std::istringstream request_line_stream(request_line);
-				request_line_stream >> request_method;
-				// We only support GET method
-				if ("GET" != request_method)
-				{
-					// Unsupported method.
-					service->m_response_status_code = 501;
+				case HTTPRequestParser::result::complete:
+					on_request_received(std::move(service));
+					return;
+				case HTTPRequestParser::result::bad_request:
+					service->m_response_status_code = 400;
 					send_response(std::move(service));
 					return;
-				}
-
-				request_line_stream >> service->m_requested_resource;
-
-				std::string request_http_version;
-				request_line_stream >> request_http_version;
+				case HTTPRequestParser::result::incomplete:
+					break;
+			}
 
-				if ("HTTP/1.1" != request_http_version)
+			if (service->m_request_end == request_buf.size())
+			{
+				if (service->m_request_begin == 0)
 				{
-					// Unsupported HTTP version or bad request.
-					service->m_response_status_code = 505;
+					// Request head doesn't fit into the buffer.
+					service->m_response_status_code = 413;
 					send_response(std::move(service));
 					return;
 				}
 
-				// At this point the request line is successfully
-				// received and parsed. Now read the request headers.
-				auto &&sock = *service->m_sock;
-				auto &&request = service->m_request;
-				boost::asio::async_read_until(
-					sock,
-					request,
-					"\r\n\r\n",
-					[svc=std::move(service)](auto &&ec, auto &&bt) mutable
-					{
-						Service::on_headers_received(
-							std::move(svc),
-							std::forward<decltype(ec)>(ec),
-							std::forward<decltype(bt)>(bt)
-						);
-					}
-				);
-				return;
+				// Move beginning of the pipelined request
+				// to the beginning of the buffer.
+				std::memmove(request_buf.data(), data.data(), data.size());
+				service->m_request_begin = 0;
+				service->m_request_end = data.size();
 			}
 
-			std::cerr << "Error occured! Error code = "
-			<< ec
-			<< '\n';
-
-			if (ec == boost::asio::error::not_found)
-			{
-				// No delimiter has been found in the
-				// request message.
-
-				service->m_response_status_code = 413;
-				send_response(std::move(service));
-				return;
-			}
+			auto &&sock = *service->m_sock;
+			auto buf = boost::asio::buffer(
+				request_buf.data() + service->m_request_end,
+				request_buf.size() - service->m_request_end
+			);
+			sock.async_read_some(
+				buf,
+				[svc=std::move(service)](auto &&ec, auto &&bt) mutable
+				{
+					Service::on_data_received(
+						std::move(svc),
+						std::forward<decltype(ec)>(ec),
+						std::forward<decltype(bt)>(bt)
+					);
+				}
+			);
 		}
 
-		void static on_headers_received(
+		void static on_data_received(
 			std::unique_ptr<Service> service,
 			const boost::system::error_code &ec,
 			std::size_t bytes_transferred
@@ -132,68 +512,89 @@ class Service
 		{
 			if (!ec)
 			{
-				// Parse and store headers.
-				std::istream request_stream(&service->m_request);
-				std::string header_name, header_value;
+				service->m_request_end += bytes_transferred;
+				read_request(std::move(service));
+				return;
+			}
 
-				while (std::getline(request_stream, header_name, ':'))
-				{
-					if (std::getline(request_stream, header_value,'\r'))
-					{
-						// Remove symbol '\n' from the stream.
-						request_stream.get();
-						service->m_request_headers.emplace(
-							std::move(header_name),
-							std::move(header_value)
-						);
-					}
-				}
-				// Now we have all we need to process the request.
-				service->process_request();
-				send_response(std::move(service));
+			if (ec == boost::asio::error::eof)
+			{
+				// Client has closed the persistent connection.
 				return;
 			}
 
 			std::cerr << "Error occured! Error code = "
 			<< ec
 			<< '\n';
+		}
+
+		void static on_request_received(
+			std::unique_ptr<Service> service
+		)
+		{
+			auto &&parser = service->m_parser;
 
-			if (ec == boost::asio::error::not_found)
+			// Persistent connections are default since HTTP/1.1,
+			// HTTP/1.0 client has to ask for keep-alive.
+			service->m_keep_alive = "HTTP/1.0" != parser.version();
+
+			if (auto header = parser.find_header("connection"); header)
 			{
-				// No delimiter has been found in the
-				// request message.
+				if (HTTPRequestParser::iequals(header->value, "close"))
+					service->m_keep_alive = false;
+				else if (HTTPRequestParser::iequals(header->value, "keep-alive"))
+					service->m_keep_alive = true;
+			}
+
+			// Request bodies are never read, the connection can't
+			// be reused if the request has got one.
+			auto content_length = parser.find_header("content-length");
+			if (
+				parser.find_header("transfer-encoding") ||
+				(content_length && content_length->value != "0")
+			)
+				service->m_keep_alive = false;
 
-				service->m_response_status_code = 413;
+			// We only support GET method
+			if ("GET" != parser.method())
+			{
+				// Unsupported method.
+				service->m_response_status_code = 501;
+				send_response(std::move(service));
+				return;
+			}
+
+			if (
+				"HTTP/1.1" != parser.version() &&
+				"HTTP/1.0" != parser.version()
+			)
+			{
+				// Unsupported HTTP version.
+				service->m_response_status_code = 505;
 				send_response(std::move(service));
 				return;
 			}
+
+			// Now we have all we need to process the request.
+			service->m_requested_resource = parser.target();
+			service->process_request();
+			send_response(std::move(service));
 		}
 
 		void process_request()
 		{
 			// Read file.
-			std::string resource_file_path =
-				m_resource_root + m_requested_resource;
+			std::string resource_file_path = m_resource_root;
+			resource_file_path.append(m_requested_resource);
 
-			std::error_code ec;
-			if (!std::filesystem::is_regular_file(resource_file_path, ec))
+			// Root is served by its index file. Resources are cached
+			// by the paths of their files, so the index file which
+			// has been replaced by another one isn't served.
+			if (m_requested_resource.find_first_not_of("/") == std::string::npos)
 			{
-				resource_file_path.clear();
-				if (m_requested_resource.find_first_not_of("/") == std::string::npos)
-				{
-					for (auto &de : std::filesystem::directory_iterator(m_resource_root))
-					{
-						if (de.is_regular_file(ec))
-						{
-							auto &&path = de.path().generic_string();
-							auto &&filename = de.path().filename().generic_string();
-							if (!filename.find("index"))
-								resource_file_path = path;
-						}
-					}
-				}
-
-				if (!std::filesystem::exists(resource_file_path, ec))
+				resource_file_path =
+					DirectoryIndexCache::instance().find(m_resource_root);
+				if (resource_file_path.empty())
 				{
 					// Resource not found.
 					m_response_status_code = 404;
@@ -201,6 +602,69 @@ class Service
 				}
 			}
 
+			auto &&cache = ResourceCache::instance();
+			if (m_resource = cache.find(resource_file_path); m_resource)
+				return;
+
+			std::error_code ec;
+			if (!std::filesystem::is_regular_file(resource_file_path, ec))
+			{
+				// Resource not found.
+				m_response_status_code = 404;
+				return;
+			}
+
+			// File modification time is taken before reading so
+			// the changes made during the reading are not missed.
+			auto mtime = std::filesystem::last_write_time(resource_file_path, ec);
+
+#ifdef __linux__
+			m_file_fd = ::open(resource_file_path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat file_stat;
+			if (m_file_fd < 0 || ::fstat(m_file_fd, &file_stat) < 0)
+			{
+				// Could not open file.
+				// Something bad happened.
+				close_file();
+				m_response_status_code = 500;
+				return;
+			}
+
+			m_resource_size = static_cast<std::size_t>(file_stat.st_size);
+			if (SENDFILE_THRESHOLD <= m_resource_size)
+			{
+				// Large file is sent directly from the page cache
+				// by sendfile(2) in send_file(), it never goes
+				// through user space memory.
+				m_file_offset = 0;
+				return;
+			}
+
+			// Small file is cheaper to send by the single
+			// gathered write along with the headers.
+			std::vector<char> body(m_resource_size);
+			std::size_t bytes_read = 0;
+			while (bytes_read != m_resource_size)
+			{
+				auto n = ::read(
+					m_file_fd,
+					body.data() + bytes_read,
+					m_resource_size - bytes_read
+				);
+				if (n <= 0)
+				{
+					// File has been truncated or
+					// read error occured. Response has
+					// no body, its length must say so.
+					close_file();
+					m_resource_size = 0;
+					m_response_status_code = 500;
+					return;
+				}
+				bytes_read += static_cast<std::size_t>(n);
+			}
+			close_file();
+#else
 			std::ifstream resource_fstream(
 				resource_file_path,
 				std::ifstream::binary
@@ -216,57 +680,84 @@ class Service
 
 			// Find out file size.
 			resource_fstream.seekg(0, std::ifstream::end);
-			m_resource_buffer.resize(
+			std::vector<char> body(
 				static_cast<std::size_t>(
 					resource_fstream.tellg()
 				)
 			);
 
 			resource_fstream.seekg(std::ifstream::beg);
-			resource_fstream.read(m_resource_buffer.data(), m_resource_buffer.size());
-			std::string buffer(5,'\0'); 
-			if (auto[p, ec] = std::to_chars(
-				buffer.data(), 
-				buffer.data() + buffer.size(), 
-				m_resource_buffer.size());
-				ec == std::errc()
-			)
-			{
-				buffer.resize(p - buffer.data());
-			}
-			else
-			{
-				// Could not open file.
-				// Something bad happened.
-				m_response_status_code = 500;
-			}
-			m_response_headers = "content-length: " + buffer + "\r\n\r\n";
+			resource_fstream.read(body.data(), body.size());
+#endif
+			auto resource = std::make_shared<ResourceCache::Resource>();
+			resource->path = resource_file_path;
+			resource->headers = make_content_length_header(body.size());
+			resource->body = std::move(body);
+			resource->mtime = mtime;
+
+			m_resource = resource;
+			if (!ec)
+				cache.insert(resource_file_path, std::move(resource));
 		}
 
 		void static send_response(
 			std::unique_ptr<Service> service
 		)
 		{
-			service->m_sock->shutdown(
-				boost::asio::ip::tcp::socket::shutdown_receive
-			);
+			// Request head which is malformed or too large hasn't
+			// been parsed, the end of the request is unknown and
+			// the connection can't be reused.
+			if (
+				service->m_response_status_code == 400 ||
+				service->m_response_status_code == 413
+			)
+				service->m_keep_alive = false;
+
+			if (!service->m_keep_alive)
+			{
+				boost::system::error_code ignored_ec;
+				service->m_sock->shutdown(
+					boost::asio::ip::tcp::socket::shutdown_receive,
+					ignored_ec
+				);
+			}
 
 			auto status_line_sv = http_status_table.at(
 				service->m_response_status_code
 			);
 			service->m_response_status_line = "HTTP/1.1 ";
 			service->m_response_status_line.append(status_line_sv);
-			service->m_response_status_line.append(" \r\n");
+			service->m_response_status_line.append("\r\n");
 
-			std::vector response_buffers = {
+			// Content length is always sent so that the client
+			// is able to find the end of the response on
+			// a persistent connection.
+			std::string_view content_length_header;
+			if (service->m_resource)
+			{
+				content_length_header = service->m_resource->headers;
+			}
+			else
+			{
+				service->m_response_headers =
+					make_content_length_header(service->m_resource_size);
+				content_length_header = service->m_response_headers;
+			}
+
+			std::string_view connection_header = service->m_keep_alive ?
+				"connection: keep-alive\r\n\r\n" :
+				"connection: close\r\n\r\n";
+
+			std::vector<boost::asio::const_buffer> response_buffers = {
 				boost::asio::buffer(service->m_response_status_line),
-				boost::asio::buffer(service->m_response_headers)
+				boost::asio::buffer(content_length_header),
+				boost::asio::buffer(connection_header)
 			};
-			response_buffers.reserve(3);
+			response_buffers.reserve(4);
 
-			if (service->m_resource_buffer.size())
+			if (service->m_resource && service->m_resource->body.size())
 				response_buffers.push_back(
-					boost::asio::buffer(service->m_resource_buffer)
+					boost::asio::buffer(service->m_resource->body)
 				);
 
 			// Initiate asynchronous write operation.
@@ -276,7 +767,16 @@ class Service
 				response_buffers,
 				[svc=std::move(service)](auto &&ec, auto &&bt) mutable
 				{
-					svc->on_headers_received(
+#ifdef __linux__
+					if (!ec && svc->m_file_fd >= 0)
+					{
+						// Headers are sent, now send the file body.
+						Service::send_file(std::move(svc));
+						return;
+					}
+#endif
+					Service::on_response_sent(
+						std::move(svc),
 						std::forward<decltype(ec)>(ec),
 						std::forward<decltype(bt)>(bt)
 					);
@@ -284,7 +784,79 @@ class Service
 			);
 		}
 
-		void on_headers_received(
+#ifdef __linux__
+		// Sends the rest of the opened file with sendfile(2).
+		// The socket is switched to non-blocking mode and
+		// every time the kernel send buffer is full we wait
+		// until the socket becomes writable again, so the
+		// I/O thread never blocks and no user space buffer
+		// is needed whatever the file size is.
+		void static send_file(
+			std::unique_ptr<Service> service
+		)
+		{
+			auto &&sock = *service->m_sock;
+			boost::system::error_code ec;
+			sock.native_non_blocking(true, ec);
+
+			while (
+				!ec &&
+				static_cast<std::size_t>(service->m_file_offset) != service->m_resource_size
+			)
+			{
+				auto n = ::sendfile(
+					sock.native_handle(),
+					service->m_file_fd,
+					&service->m_file_offset,
+					service->m_resource_size -
+						static_cast<std::size_t>(service->m_file_offset)
+				);
+
+				if (0 < n)
+					continue;
+
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				{
+					// Socket send buffer is full.
+					sock.async_wait(
+						boost::asio::ip::tcp::socket::wait_write,
+						[svc=std::move(service)](auto &&ec) mutable
+						{
+							if (ec)
+							{
+								Service::on_response_sent(
+									std::move(svc),
+									std::forward<decltype(ec)>(ec),
+									0
+								);
+								return;
+							}
+							Service::send_file(std::move(svc));
+						}
+					);
+					return;
+				}
+
+				if (n < 0 && errno == EINTR)
+					continue;
+
+				ec = n < 0 ?
+					boost::system::error_code(
+						errno,
+						boost::asio::error::get_system_category()
+					) :
+					// File has been truncated while it was sent.
+					boost::asio::error::eof;
+			}
+
+			auto bytes_transferred = static_cast<std::size_t>(service->m_file_offset);
+			service->close_file();
+			on_response_sent(std::move(service), ec, bytes_transferred);
+		}
+#endif
+
+		void static on_response_sent(
+			std::unique_ptr<Service> service,
 			const boost::system::error_code &ec,
 			std::size_t bytes_transferred
 		)
@@ -294,24 +866,93 @@ class Service
 				std::cerr << "Error occured! Error code = "
 				<< ec
 				<< '\n';
+				return;
 			}
+
+			if (service->m_keep_alive)
+			{
+				// Wait for the next request on the same connection.
+				service->reset();
+				read_request(std::move(service));
+			}
+		}
+
+		// Prepares the service for the next request
+		// of the persistent connection.
+		void reset()
+		{
+			// Drop the head of the served request.
+			m_request_begin += m_parser.head_size();
+			if (m_request_begin == m_request_end)
+				m_request_begin = m_request_end = 0;
+			m_parser.reset();
+			m_resource.reset();
+			m_resource_size = 0;
+			m_response_status_code = 200;
+			close_file();
+		}
+
+		void close_file()
+		{
+#ifdef __linux__
+			if (m_file_fd >= 0)
+			{
+				::close(m_file_fd);
+				m_file_fd = -1;
+			}
+#endif
+		}
+
+		std::string static make_content_length_header(std::size_t length)
+		{
+			std::array<char, 20> buffer;
+			auto[p, ec] = std::to_chars(
+				buffer.data(), 
+				buffer.data() + buffer.size(), 
+				length
+			);
+			std::string header = "content-length: ";
+			header.append(buffer.data(), p);
+			header.append("\r\n");
+			return header;
 		}
 	private:
 		std::string m_resource_root;
+		constexpr inline std::size_t static MAX_REQUEST_HEAD_SIZE = 8 * 1024;
+
 		std::unique_ptr<boost::asio::ip::tcp::socket> m_sock;
-		boost::asio::streambuf m_request;
-		std::map<std::string,std::string> m_request_headers;
-		std::string m_requested_resource;
+
+		// Received bytes of requests which are not served yet
+		// are kept between m_request_begin and m_request_end.
+		std::array<char, MAX_REQUEST_HEAD_SIZE> m_request_buf;
+		std::size_t m_request_begin = 0;
+		std::size_t m_request_end = 0;
+		HTTPRequestParser m_parser;
+		std::string_view m_requested_resource;
+		bool m_keep_alive = false;
 		
-		std::vector<char> m_resource_buffer;
+		// Small file loaded into memory.
+		ResourceCache::resource_ptr m_resource;
+		// Size of the large file sent by sendfile(2).
+		std::size_t m_resource_size = 0;
+#ifdef __linux__
+		// Opened large file and position of the first byte
+		// which is not sent yet.
+		int m_file_fd = -1;
+		off_t m_file_offset = 0;
+
+		// Files of this size and larger are sent with sendfile(2).
+		constexpr inline std::size_t static SENDFILE_THRESHOLD = 64 * 1024;
+#endif
 		std::uint16_t m_response_status_code = 200;
-		std::string m_response_headers = "\r\n\r\n";
+		std::string m_response_headers;
 		std::string m_response_status_line;
 
 		static const inline std::map<std::size_t, std::string_view> http_status_table =
 		{
 			{200, "200 OK"},
 			{404, "404 Not Found"},
+			{400, "400 Bad Request"},
 			{413, "413 Request Entity Too Large"},
 			{500, "500 Server Error"},
 			{501, "501 Not Implemented"},
@@ -319,24 +960,40 @@ class Service
 		};
 };
 
+#ifdef SO_REUSEPORT
+// Lets several sockets listen on the same port, the kernel
+// distributes incoming connections between them.
+using reuse_port =
+	boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
 class Acceptor
 {
 	public:
 		Acceptor(
 			std::string_view resources_root_path,
 			boost::asio::io_context &ioc,
-			std::uint16_t port_num
+			std::uint16_t port_num,
+			bool share_port = false
 		) :
 		m_resources_root_path(resources_root_path),
 		m_ioc(ioc),
-		m_acceptor(
-			m_ioc,
-			boost::asio::ip::tcp::endpoint(
+		m_acceptor(m_ioc)
+		{
+			boost::asio::ip::tcp::endpoint ep(
 				boost::asio::ip::address_v4::any(),
 				port_num
-			)
-		)
-		{}
+			);
+			m_acceptor.open(ep.protocol());
+			m_acceptor.set_option(
+				boost::asio::ip::tcp::acceptor::reuse_address(true)
+			);
+#ifdef SO_REUSEPORT
+			if (share_port)
+				m_acceptor.set_option(reuse_port(true));
+#endif
+			m_acceptor.bind(ep);
+		}
 
 		// Start accepting incoming connection requests.
 		void start()
@@ -404,47 +1061,108 @@ class Acceptor
 class Server
 {
 	public:
+		enum class Mode
+		{
+			// All threads run the single io_context
+			// with the single acceptor.
+			shared_io_context,
+			// Every thread runs its own io_context, is pinned to
+			// its own CPU and accepts connections on its own
+			// SO_REUSEPORT socket. Connections are balanced by
+			// the kernel and never migrate between threads.
+			io_context_per_core
+		};
+
 		// Start the server.
 		void start(
 			std::string_view root_path,
 			std::uint16_t port_num,
-			std::size_t thread_pool_size
+			std::size_t thread_pool_size,
+			Mode mode = Mode::shared_io_context
 		)
 		{
 			assert(std::filesystem::is_directory(root_path));
 			assert(0 < thread_pool_size);
 
-			// Create and start Acceptor.
-			m_acc = std::make_unique<Acceptor>(root_path, m_ioc, port_num);
-			m_acc->start();
+#ifndef SO_REUSEPORT
+			// Acceptors can't share the port.
+			mode = Mode::shared_io_context;
+#endif
+			bool per_core = mode == Mode::io_context_per_core;
+			std::size_t contexts_count = per_core ? thread_pool_size : 1;
+			bool share_port = 1 < contexts_count;
+
+			for (std::size_t i = 0; i != contexts_count; ++i)
+			{
+				// io_context run by a single thread
+				// doesn't need internal locking.
+				auto &&ioc = *m_contexts.emplace_back(
+					std::make_unique<boost::asio::io_context>(
+						per_core ? 1 : BOOST_ASIO_CONCURRENCY_HINT_DEFAULT
+					)
+				);
+				m_work.emplace_back(boost::asio::make_work_guard(ioc));
+
+				// Create and start Acceptor.
+				auto &&acc = m_acceptors.emplace_back(
+					std::make_unique<Acceptor>(root_path, ioc, port_num, share_port)
+				);
+				acc->start();
+			}
 
 			// Create specified number of threads and
 			// add them to the pool.
 			for (std::size_t i = 0; i != thread_pool_size; ++i)
 			{
-				m_thread_pool.emplace_back([&ioc=m_ioc]{ioc.run();});
+				auto &&ioc = *m_contexts[i % contexts_count];
+				auto &&th = m_thread_pool.emplace_back([&ioc]{ioc.run();});
+				if (per_core)
+					pin_thread(th, i);
 			}
 		}
 
 		// Stop the server.
 		void stop()
 		{
-			m_acc->stop();
-			m_ioc.stop();
+			for (auto &&acc : m_acceptors)
+				acc->stop();
+			for (auto &&ioc : m_contexts)
+				ioc->stop();
 
 			for (auto &&th : m_thread_pool)
 				if (th.joinable()) th.join();
 		}
 	private:
-		boost::asio::io_context m_ioc;
+		void static pin_thread(std::thread &th, std::size_t cpu)
+		{
+#ifdef __linux__
+			auto cpu_count = std::thread::hardware_concurrency();
+			if (!cpu_count)
+				return;
+
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu % cpu_count, &cpu_set);
+			// Failure to pin the thread is not fatal,
+			// the thread just may be migrated.
+			pthread_setaffinity_np(
+				th.native_handle(),
+				sizeof(cpu_set),
+				&cpu_set
+			);
+#endif
+		}
+	private:
 		using work_guard = 
 			boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
-		work_guard m_work{boost::asio::make_work_guard(m_ioc)};
-		std::unique_ptr<Acceptor> m_acc;
+		std::vector<std::unique_ptr<boost::asio::io_context>> m_contexts;
+		std::vector<work_guard> m_work;
+		std::vector<std::unique_ptr<Acceptor>> m_acceptors;
 		std::vector<std::thread> m_thread_pool;
 };
 
 constexpr std::size_t DEFAULT_THREAD_POOL_SIZE = 2;
+constexpr std::size_t RESOURCE_CACHE_CAPACITY = 256 * 1024 * 1024;
 
 // Run tcp_asynchronous client from 03_impl_client_apps
 // to test this example
@@ -456,10 +1174,17 @@ int main(int argc, char *argv[])
 
 	try
 	{
+		ResourceCache::instance().set_capacity(RESOURCE_CACHE_CAPACITY);
+
 		Server srv;
 		std::size_t thread_pool_size = std::thread::hardware_concurrency();
 		if (!thread_pool_size) thread_pool_size = DEFAULT_THREAD_POOL_SIZE;
-		srv.start(root_dir, port_num, thread_pool_size);
+		srv.start(
+			root_dir,
+			port_num,
+			thread_pool_size,
+			Server::Mode::io_context_per_core
+		);
 		std::cin.get();
 		srv.stop();
 	}
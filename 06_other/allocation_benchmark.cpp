@@ -0,0 +1,235 @@
+// Counts heap allocations made by AsyncTCPClient and the asynchronous
+// Server of common/ while they exchange requests. The server runs in
+// the child process, so allocations of each side are counted apart.
+// Global operator new is replaced by the counting one. After the
+// warm-up neither the client nor the server may allocate per request,
+// whether every request opens the connection of its own or requests
+// share persistent connections. The program fails if they do.
+// Server runs the io_context per core: handlers which migrate between
+// threads of the shared io_context miss the thread-local recycling
+// caches of Asio and allocate now and then.
+// POSIX only, the processes are created with fork().
+
+#include "../common/async_tcp_client.hpp"
+#include "../common/async_tcp_server.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+	std::atomic<std::size_t> g_allocations{0};
+}
+
+// Replacements mustn't be inlined: GCC would see free() called on the
+// pointer returned by operator new and warn about the mismatch.
+[[gnu::noinline]] void *operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	auto align = static_cast<std::size_t>(alignment);
+	if (auto p = std::aligned_alloc(align, (size + align - 1) / align * align))
+		return p;
+	throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+	std::free(p);
+}
+
+constexpr std::uint16_t PORT = 3344;
+constexpr std::size_t WARM_UP_REQUESTS = 2000;
+constexpr std::size_t MEASURED_REQUESTS = 20000;
+
+// Commands sent to the server process.
+constexpr char START_COUNTING = 's';
+constexpr char REPORT_COUNT = 'r';
+
+// Serves requests until the command pipe is closed. Allocations made
+// since START_COUNTING are written to the result pipe on REPORT_COUNT.
+int runServer(int command_fd, int result_fd)
+{
+	Server srv;
+	srv.start(PORT, 2, Server::Mode::io_context_per_core);
+
+	char command = 0;
+	write(result_fd, &command, 1);
+
+	std::size_t start = 0;
+	while (read(command_fd, &command, 1) == 1)
+	{
+		if (command == START_COUNTING)
+		{
+			start = g_allocations.load();
+		}
+		else if (command == REPORT_COUNT)
+		{
+			std::size_t count = g_allocations.load() - start;
+			write(result_fd, &count, sizeof(count));
+		}
+	}
+
+	srv.stop();
+	return 0;
+}
+
+struct Result
+{
+	std::size_t client_allocations = 0;
+	std::size_t server_allocations = 0;
+	std::size_t failed = 0;
+};
+
+// Requests are sent one after another, the next one is sent when
+// the previous one has completed.
+Result measure(bool pooled, int command_fd, int result_fd)
+{
+	AsyncTCPClient client(2);
+	if (pooled)
+		client.enableConnectionPooling(2, std::chrono::seconds(10));
+
+	std::atomic<std::size_t> completed{0};
+	std::atomic<std::size_t> failed{0};
+	auto callback = [&completed, &failed](
+		std::size_t,
+		std::string_view,
+		const boost::system::error_code &ec
+	)
+	{
+		if (ec)
+			++failed;
+		++completed;
+	};
+
+	std::size_t request_id = 0;
+	auto run = [&](std::size_t count)
+	{
+		for (std::size_t i = 0; i != count; ++i)
+		{
+			auto target = completed.load() + 1;
+			client.emulateLongComputationOp(
+				std::chrono::seconds(0),
+				"127.0.0.1",
+				PORT,
+				callback,
+				request_id++
+			);
+			while (completed.load() != target)
+				std::this_thread::yield();
+		}
+	};
+
+	run(WARM_UP_REQUESTS);
+
+	Result result;
+	write(command_fd, &START_COUNTING, 1);
+	auto start = g_allocations.load();
+	failed = 0;
+
+	run(MEASURED_REQUESTS);
+
+	result.client_allocations = g_allocations.load() - start;
+	result.failed = failed;
+	write(command_fd, &REPORT_COUNT, 1);
+	read(result_fd, &result.server_allocations, sizeof(result.server_allocations));
+
+	client.close();
+	return result;
+}
+
+int main()
+{
+	// The server is started before any thread is.
+	int command_pipe[2];
+	int result_pipe[2];
+	if (pipe(command_pipe) || pipe(result_pipe))
+	{
+		std::cerr << "Failed to create pipes.\n";
+		return 1;
+	}
+
+	auto pid = fork();
+	if (pid < 0)
+	{
+		std::cerr << "Failed to start the server process.\n";
+		return 1;
+	}
+	if (pid == 0)
+	{
+		close(command_pipe[1]);
+		close(result_pipe[0]);
+		return runServer(command_pipe[0], result_pipe[1]);
+	}
+
+	close(command_pipe[0]);
+	close(result_pipe[1]);
+
+	// Wait until the server is listening.
+	char ready = 0;
+	read(result_pipe[0], &ready, 1);
+
+	bool is_ok = true;
+	for (bool pooled : {false, true})
+	{
+		auto result = measure(pooled, command_pipe[1], result_pipe[0]);
+		auto per_request = [](std::size_t count)
+		{
+			return static_cast<double>(count) / MEASURED_REQUESTS;
+		};
+
+		std::cout << (pooled ? "pooled connections" : "connection per request")
+		<< ": client " << per_request(result.client_allocations)
+		<< ", server " << per_request(result.server_allocations)
+		<< " allocations per request";
+		if (result.failed)
+			std::cout << ", " << result.failed << " requests failed";
+		std::cout << '\n';
+
+		if (
+			result.failed ||
+			result.client_allocations ||
+			result.server_allocations
+		)
+			is_ok = false;
+	}
+
+	close(command_pipe[1]);
+	waitpid(pid, nullptr, 0);
+
+	if (!is_ok)
+	{
+		std::cerr << "FAILED: requests allocate memory in steady state.\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <boost/asio.hpp>
+
+#include "../common/simd_read_until.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Synchronous stream which returns the data from memory in chunks
+// of the given size, like a socket receiving TCP segments does.
+class MemoryStream
+{
+	public:
+		MemoryStream(std::string_view data, std::size_t chunk_size) :
+		m_data(data),
+		m_chunk_size(chunk_size)
+		{}
+
+		template <class MutableBufferSequence>
+		std::size_t read_some(
+			const MutableBufferSequence &buffers,
+			boost::system::error_code &ec
+		)
+		{
+			if (m_pos == m_data.size())
+			{
+				ec = boost::asio::error::eof;
+				return 0;
+			}
+
+			auto size = std::min(m_chunk_size, m_data.size() - m_pos);
+			auto copied = boost::asio::buffer_copy(
+				buffers,
+				boost::asio::buffer(m_data.data() + m_pos, size)
+			);
+			m_pos += copied;
+			ec = {};
+			return copied;
+		}
+
+		template <class MutableBufferSequence>
+		std::size_t read_some(const MutableBufferSequence &buffers)
+		{
+			boost::system::error_code ec;
+			auto size = read_some(buffers, ec);
+			boost::asio::detail::throw_error(ec, "read_some");
+			return size;
+		}
+
+	private:
+		std::string_view m_data;
+		std::size_t m_chunk_size;
+		std::size_t m_pos = 0;
+};
+
+// Builds HTTP request head of approximately the given size.
+std::string make_head(std::size_t size)
+{
+	std::string head = "GET /index.html HTTP/1.1\r\n";
+	while (head.size() + 4 < size)
+		head.append("X-Header: 0123456789abcdefghijklmnopqrstuvwxyz\r\n");
+	head.append("\r\n");
+	return head;
+}
+
+template <class ReadUntil>
+double measure(const std::string &head, std::size_t iterations, ReadUntil read_until)
+{
+	constexpr std::size_t chunk_size = 1460; // Typical TCP segment payload.
+	std::size_t total = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i != iterations; ++i)
+	{
+		MemoryStream stream(head, chunk_size);
+		boost::asio::streambuf buf;
+		total += read_until(stream, buf);
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	if (total != head.size() * iterations)
+		std::cerr << "Delimiter has been found at the wrong place!\n";
+
+	return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+
+int main()
+{
+	struct Case
+	{
+		const char *name;
+		std::size_t size;
+		std::size_t iterations;
+	};
+
+	const Case cases[] = {
+		{"1 KB", 1024, 100000},
+		{"16 KB", 16 * 1024, 10000},
+		{"1 MB", 1024 * 1024, 100},
+	};
+
+	for (auto &&c : cases)
+	{
+		auto head = make_head(c.size);
+
+		auto stock = measure(
+			head,
+			c.iterations,
+			[](auto &stream, auto &buf)
+			{
+				return boost::asio::read_until(stream, buf, "\r\n\r\n");
+			}
+		);
+
+		auto simd = measure(
+			head,
+			c.iterations,
+			[](auto &stream, auto &buf)
+			{
+				return simd::read_until(stream, buf, "\r\n\r\n");
+			}
+		);
+
+		std::cout << c.name << " header: "
+		<< "boost::asio::read_until " << stock << " us, "
+		<< "simd::read_until " << simd << " us\n";
+	}
+
+	return 0;
+}
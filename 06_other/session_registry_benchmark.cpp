@@ -0,0 +1,110 @@
+#include "../common/sharded_registry.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Registry of active sessions as it was implemented in
+// AsyncTCPClient before: the map guarded by the single mutex.
+template <class Key, class Value>
+class MutexRegistry
+{
+	public:
+		void insert(const Key &key, Value value)
+		{
+			std::lock_guard lock(m_guard);
+			m_entries[key] = std::move(value);
+		}
+
+		template <class Func>
+		bool visit(const Key &key, Func &&func)
+		{
+			std::lock_guard lock(m_guard);
+			auto it = m_entries.find(key);
+			if (it == m_entries.end())
+				return false;
+
+			std::forward<Func>(func)(it->second);
+			return true;
+		}
+
+		bool erase(const Key &key)
+		{
+			std::lock_guard lock(m_guard);
+			return m_entries.erase(key) != 0;
+		}
+
+	private:
+		std::mutex m_guard;
+		std::map<Key, Value> m_entries;
+};
+
+struct Session
+{
+	bool cancelled = false;
+};
+
+// Every submitter thread registers requests, cancels some of them
+// and removes them on completion like AsyncTCPClient does.
+// Returns millions of requests per second.
+template <class Registry>
+double measure(std::size_t thread_count, std::size_t requests_per_thread)
+{
+	Registry registry;
+	std::vector<std::thread> threads;
+
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t t = 0; t != thread_count; ++t)
+	{
+		threads.emplace_back(
+			[&registry, t, requests_per_thread]
+			{
+				auto first_id = t * requests_per_thread;
+				for (std::size_t i = 0; i != requests_per_thread; ++i)
+				{
+					auto id = first_id + i;
+					registry.insert(id, std::make_shared<Session>());
+					if (i % 8 == 0)
+						registry.visit(id, [](auto &&s){ s->cancelled = true; });
+					registry.erase(id);
+				}
+			}
+		);
+	}
+
+	for (auto &&th : threads)
+		th.join();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+
+	auto requests = static_cast<double>(thread_count * requests_per_thread);
+	return requests / std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+int main()
+{
+	constexpr std::size_t requests_per_thread = 200000;
+
+	using value_type = std::shared_ptr<Session>;
+
+	for (std::size_t thread_count : {1, 2, 4, 8, 16})
+	{
+		auto mutex_rate = measure<MutexRegistry<std::size_t, value_type>>(
+			thread_count,
+			requests_per_thread
+		);
+		auto sharded_rate = measure<ShardedRegistry<std::size_t, value_type>>(
+			thread_count,
+			requests_per_thread
+		);
+
+		std::cout << thread_count << " submitter threads: "
+		<< "std::map + std::mutex " << mutex_rate << " M req/s, "
+		<< "ShardedRegistry " << sharded_rate << " M req/s\n";
+	}
+
+	return 0;
+}
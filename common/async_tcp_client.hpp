@@ -0,0 +1,2403 @@
+#pragma once
+
+// Asynchronous TCP client of the "emulate long computation" protocol
+// spoken by the servers of 04_impl_server_apps. Requests run on a pool
+// of I/O threads and may share persistent connections, be limited by
+// the admission control, hedged and given deadlines. Used by
+// 03_impl_client_apps/tcp_asynchronous.cpp and 06_other benchmarks.
+
+// Asio 1.74 uses std::exchange in awaitable.hpp without including it.
+#include <utility>
+#include <boost/asio.hpp>
+
+#include "sharded_registry.hpp"
+#include "timing_wheel.hpp"
+#include "pool_allocator.hpp"
+#include "handler_allocator.hpp"
+#include "latency_histogram.hpp"
+
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <utility>
+#include <memory>
+#include <iostream>
+#include <charconv>
+#include <optional>
+#include <limits>
+
+// Counts sessions bound to an I/O thread. Session holds the token
+// until it completes, so the counter is decremented when the
+// session is closed or destroyed.
+class LoadToken
+{
+	public:
+		LoadToken() = default;
+
+		explicit LoadToken(std::atomic<std::size_t> &load) : m_load(&load)
+		{
+			++*m_load;
+		}
+
+		LoadToken(LoadToken &&other) noexcept :
+		m_load(std::exchange(other.m_load, nullptr))
+		{}
+
+		LoadToken &operator=(LoadToken &&other) noexcept
+		{
+			std::swap(m_load, other.m_load);
+			return *this;
+		}
+
+		~LoadToken()
+		{
+			if (m_load)
+				--*m_load;
+		}
+
+		// Accounts one more session on the same I/O thread.
+		LoadToken share() const
+		{
+			return m_load ? LoadToken(*m_load) : LoadToken();
+		}
+
+	private:
+		std::atomic<std::size_t> *m_load = nullptr;
+};
+
+// Pool of I/O threads each running its own io_context.
+// Every session is bound to one io_context for its whole life,
+// so handlers of the session never run concurrently and the
+// session state needs no locking.
+class IoContextPool
+{
+	public:
+		enum class Placement
+		{
+			round_robin, // Sessions are spread over threads in turn.
+			least_loaded // Session goes to the thread with fewest sessions.
+		};
+
+		IoContextPool(std::size_t size, Placement placement) :
+		m_placement(placement)
+		{
+			assert(0 < size);
+
+			for (std::size_t i = 0; i != size; ++i)
+				m_workers.push_back(std::make_unique<Worker>());
+			for (auto &&worker : m_workers)
+				worker->thread = std::thread([&ioc=worker->ioc]{ ioc.run(); });
+		}
+
+		// Chooses the io_context for the new session.
+		std::pair<boost::asio::io_context&, LoadToken> pick()
+		{
+			Worker *worker = nullptr;
+			if (m_placement == Placement::round_robin)
+			{
+				worker = m_workers[m_next++ % m_workers.size()].get();
+			}
+			else
+			{
+				worker = m_workers.front().get();
+				for (auto &&w : m_workers)
+					if (w->load < worker->load)
+						worker = w.get();
+			}
+
+			return {worker->ioc, LoadToken(worker->load)};
+		}
+
+		std::size_t size() const
+		{
+			return m_workers.size();
+		}
+
+		void stop()
+		{
+			// Destroy work objects. This allows the I/O threads to
+			// exit the event loop when are no more pending
+			// asynchronous operations.
+			for (auto &&worker : m_workers)
+				worker->work.reset();
+
+			// Wait for the I/O threads to exit.
+			for (auto &&worker : m_workers)
+				if (worker->thread.joinable())
+					worker->thread.join();
+		}
+
+	private:
+		using work_type =
+			boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+		struct Worker
+		{
+			// io_context is run by the single thread.
+			boost::asio::io_context ioc{1};
+			std::unique_ptr<work_type> work{
+				std::make_unique<work_type>(boost::asio::make_work_guard(ioc))
+			};
+			std::atomic<std::size_t> load{0};
+			std::thread thread;
+		};
+
+		const Placement m_placement;
+		std::vector<std::unique_ptr<Worker>> m_workers;
+		std::atomic<std::size_t> m_next{0};
+};
+
+class Connection;
+
+// Request and response buffers take memory from the pool, so
+// a request made in steady state doesn't allocate from the heap.
+using PooledString =
+	std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+using ResponseBuffer = boost::asio::basic_streambuf<PoolAllocator<char>>;
+
+// Time limits of the request phases, zero means no limit.
+// Request sent over the pooled connection has only read deadline,
+// counted from sending the request, and overall deadline. It doesn't
+// connect and write on its own.
+struct RequestDeadlines
+{
+	std::chrono::steady_clock::duration connect{};
+	std::chrono::steady_clock::duration write{};
+	std::chrono::steady_clock::duration read{};
+	std::chrono::steady_clock::duration overall{};
+};
+
+// Type-erased interface of a request context. It's used where
+// sessions with different callback types are kept together:
+// the registry of active sessions and pooled connections.
+class ISession
+{
+	public:
+		virtual ~ISession() = default;
+
+		virtual void invokeCallback(
+			const boost::system::error_code&
+		) = 0;
+};
+
+// State of a single request which doesn't depend on the callback type.
+// All its methods are non-virtual, so the steps of the request
+// chain are resolved at compile time.
+class BaseSession : public ISession
+{
+	// Connection sends requests and delivers responses
+	// of the sessions it carries.
+	friend class Connection;
+
+	public:
+		BaseSession(
+			boost::asio::io_context &ioc,
+			const boost::asio::ip::tcp::endpoint &ep,
+			PooledString request,
+			std::size_t id,
+			LoadToken load_token
+		) :
+		m_sock(ioc),
+		m_ep(ep),
+		m_request(std::move(request)),
+		m_id(id),
+		m_load_token(std::move(load_token)),
+		m_wheel(boost::asio::use_service<TimingWheel>(ioc))
+		{
+			// Socket is opened by async_connect, so the session sent
+			// over the pooled connection doesn't waste a descriptor.
+		}
+
+		void cancel()
+		{
+			m_was_cancelled = true;
+
+			// Socket may be not opened yet.
+			boost::system::error_code ignored_ec;
+			m_sock.cancel(ignored_ec);
+		}
+
+		bool isSessionWasCancelled() const
+		{
+			return m_was_cancelled;
+		}
+
+		std::size_t getID() const
+		{
+			return m_id;
+		}
+
+		const boost::asio::ip::tcp::endpoint &getEndpoint() const
+		{
+			return m_ep;
+		}
+
+		// Executor of the I/O thread the session is bound to.
+		boost::asio::ip::tcp::socket::executor_type getExecutor()
+		{
+			return m_sock.get_executor();
+		}
+
+		void shutdown(
+			boost::asio::ip::tcp::socket::shutdown_type type, 
+			boost::system::error_code& ec
+		)
+		{
+			m_sock.shutdown(type,ec);
+		}
+
+		// Releases the socket and the place in the load of the I/O
+		// thread once the request is complete. Session allocated
+		// in a batch lives until the whole batch completes.
+		void close()
+		{
+			boost::system::error_code ignored_ec;
+			m_sock.close(ignored_ec);
+			m_load_token = LoadToken();
+		}
+
+		// Allocator for the handlers of the operations session
+		// starts one after another. It's bound to the session
+		// I/O thread, handlers posted from other threads
+		// must use PoolAllocator instead.
+		HandlerAllocator<void> getHandlerAllocator()
+		{
+			return HandlerAllocator<void>(m_handler_memory);
+		}
+
+		void setDeadlines(const RequestDeadlines &deadlines)
+		{
+			m_deadlines = deadlines;
+		}
+
+		const RequestDeadlines &getDeadlines() const
+		{
+			return m_deadlines;
+		}
+
+		// Deadlines are tracked by the timing wheel of the I/O
+		// thread, so these methods must be called on that thread.
+		// Phase deadline replaces the deadline of the previous phase.
+		template <class OnExpire>
+		void armPhaseDeadline(
+			std::chrono::steady_clock::duration timeout,
+			OnExpire &&on_expire
+		)
+		{
+			armDeadline(m_phase_timer, timeout, std::forward<OnExpire>(on_expire));
+		}
+
+		template <class OnExpire>
+		void armOverallDeadline(
+			std::chrono::steady_clock::duration timeout,
+			OnExpire &&on_expire
+		)
+		{
+			armDeadline(m_overall_timer, timeout, std::forward<OnExpire>(on_expire));
+		}
+
+		void cancelDeadlines()
+		{
+			m_phase_timer.cancel();
+			m_overall_timer.cancel();
+		}
+
+		// Aborts the request which has missed its deadline.
+		void timeOut()
+		{
+			m_timed_out = true;
+
+			boost::system::error_code ignored_ec;
+			m_sock.cancel(ignored_ec);
+		}
+
+		bool isSessionTimedOut() const
+		{
+			return m_timed_out;
+		}
+
+		// Pooled connection the request is sent over
+		// or null if the session has its own socket.
+		std::shared_ptr<Connection> getConnection() const
+		{
+			return m_connection.lock();
+		}
+
+		void setConnection(const std::shared_ptr<Connection> &connection)
+		{
+			m_connection = connection;
+		}
+
+		template <class Callback>
+		void asyncConnect(Callback &&callback)
+		{
+			constexpr bool is_valid_callback = std::is_invocable_r_v<
+				void,
+				decltype(callback),
+				const boost::system::error_code&
+			>;
+			static_assert(is_valid_callback, "invalid callback");
+			m_sock.async_connect(
+				m_ep,
+				bindAllocator(getHandlerAllocator(), std::forward<Callback>(callback))
+			);
+		}
+
+		template <class Callback>
+		void asyncWrite(Callback &&callback) 
+		{
+			constexpr bool is_valid_callback = std::is_invocable_r_v<
+				void,
+				decltype(callback),
+				const boost::system::error_code&,
+				std::size_t
+			>;
+			static_assert(is_valid_callback, "invalid callback");
+			boost::asio::async_write(
+				m_sock,
+				getWriteBuffer(),
+				bindAllocator(getHandlerAllocator(), std::forward<Callback>(callback))
+			);
+		}
+
+		template <class Callback>
+		void asyncReadUntil(std::string_view delim, Callback &&callback)
+		{
+			constexpr bool is_valid_callback = std::is_invocable_r_v<
+				void,
+				decltype(callback),
+				const boost::system::error_code&,
+				std::size_t
+			>;
+			static_assert(is_valid_callback, "invalid callback");
+			boost::asio::async_read_until(
+				m_sock,
+				m_response_buf,
+				delim,
+				bindAllocator(getHandlerAllocator(), std::forward<Callback>(callback))
+			);
+		}
+
+	protected:
+		// Response line without the delimiter. It points into the
+		// receive buffer of the session or of its pooled connection
+		// and is valid until the request completion returns.
+		std::string_view getResponse() const
+		{
+			if (m_response)
+				return *m_response;
+
+			auto data = m_response_buf.data();
+			std::string_view response(static_cast<const char*>(data.data()), data.size());
+			return response.substr(0, response.find('\n'));
+		}
+
+	private:
+		boost::asio::const_buffer getWriteBuffer() const
+		{
+			return boost::asio::buffer(m_request);
+		}
+
+		// Response received by the pooled connection.
+		void setResponse(std::string_view response)
+		{
+			m_response = response;
+		}
+
+		template <class OnExpire>
+		void armDeadline(
+			TimingWheel::Timer &timer,
+			std::chrono::steady_clock::duration timeout,
+			OnExpire &&on_expire
+		)
+		{
+			if (timeout == std::chrono::steady_clock::duration::zero())
+				m_wheel.cancel(timer);
+			else
+				m_wheel.schedule(timer, timeout, std::forward<OnExpire>(on_expire));
+		}
+
+	private:
+		boost::asio::ip::tcp::socket m_sock; // Socket used for cmmunication.
+		boost::asio::ip::tcp::endpoint m_ep; // Remote endpoint.
+		const PooledString m_request;		 // Request string.
+
+		// streambuf where the response will be stored.
+		ResponseBuffer m_response_buf;
+		std::optional<std::string_view> m_response;
+
+		const std::size_t m_id; // Unique ID assigned to the request.
+
+		std::atomic<bool> m_was_cancelled{false};
+
+		// Accounts the session in the load of its I/O thread.
+		LoadToken m_load_token;
+
+		std::weak_ptr<Connection> m_connection;
+
+		HandlerMemory m_handler_memory;
+
+		RequestDeadlines m_deadlines;
+		TimingWheel &m_wheel;
+		TimingWheel::Timer m_phase_timer;
+		TimingWheel::Timer m_overall_timer;
+		bool m_timed_out = false;
+};
+
+// Callback taking the response as std::string_view gets it straight
+// from the receive buffer, the view is valid until the callback
+// returns. Callback taking const std::string& gets a copy.
+template <class Callback>
+constexpr bool TAKES_RESPONSE_VIEW = std::is_invocable_r_v<
+	void,
+	std::decay_t<Callback>&,
+	std::size_t,
+	std::string_view,
+	const boost::system::error_code&
+>;
+
+template <class Callback>
+void invokeResponseCallback(
+	Callback &callback,
+	std::size_t id,
+	std::string_view response,
+	const boost::system::error_code &ec
+)
+{
+	if constexpr (TAKES_RESPONSE_VIEW<Callback>)
+		callback(id, response, ec);
+	else
+		callback(id, std::string(response), ec);
+}
+
+// Class represents a context of a single request.
+// Callback is invocable type which is called when a request is complete.
+// Session is final, so invokeCallback called through the pointer to
+// Session<Callback> is devirtualized and the callback may be inlined.
+template< class Callback >
+class Session final : public BaseSession
+{
+	public:
+		Session(
+			boost::asio::io_context &ioc,
+			const boost::asio::ip::tcp::endpoint &ep,
+			PooledString request,
+			std::size_t id,
+			Callback &&callback,
+			LoadToken load_token
+		) :
+		BaseSession(
+			ioc,
+			ep,
+			std::move(request),
+			id,
+			std::move(load_token)
+		),
+		m_callback(std::forward<Callback>(callback))
+		{
+			constexpr bool is_valid_callback = TAKES_RESPONSE_VIEW<Callback> || std::is_invocable_r_v<
+				void,
+				decltype(m_callback),
+				std::size_t,
+				const std::string&,
+				const boost::system::error_code&
+			>;
+			static_assert(is_valid_callback, "invalid callback");
+		}
+
+		void invokeCallback(
+			const boost::system::error_code &ec
+		) override
+		{
+			invokeResponseCallback(m_callback, getID(), getResponse(), ec);
+		}
+
+	private:
+		// Pointer to the function to be called when the request
+		// completes.
+		std::decay_t<Callback> m_callback;
+};
+
+// Sessions of the batch placed in a single contiguous block of memory.
+// Batch is owned by shared_ptr, pointers to its sessions share its
+// ownership, so the block is freed when the last session completes.
+template <class SessionType>
+class SessionBatch
+{
+	public:
+		explicit SessionBatch(std::size_t capacity) :
+		m_sessions(std::allocator<SessionType>().allocate(capacity)),
+		m_capacity(capacity)
+		{}
+
+		SessionBatch(const SessionBatch&) = delete;
+		SessionBatch &operator=(const SessionBatch&) = delete;
+
+		~SessionBatch()
+		{
+			for (std::size_t i = 0; i != m_size; ++i)
+				m_sessions[i].~SessionType();
+			std::allocator<SessionType>().deallocate(m_sessions, m_capacity);
+		}
+
+		template <class ...Args>
+		SessionType &emplace(Args &&...args)
+		{
+			assert(m_size < m_capacity);
+			new (m_sessions + m_size) SessionType(std::forward<Args>(args)...);
+			return m_sessions[m_size++];
+		}
+
+		SessionType &operator[](std::size_t i)
+		{
+			return m_sessions[i];
+		}
+
+		std::size_t size() const
+		{
+			return m_size;
+		}
+
+	private:
+		SessionType *m_sessions;
+		const std::size_t m_capacity;
+		std::size_t m_size = 0;
+};
+
+class ConnectionPool;
+
+// Persistent connection to a server shared by many requests.
+// Requests are written one after another without waiting for
+// responses. Every request is tagged with its ID, the server returns
+// the tag with the response, so responses are matched to requests
+// whatever order they arrive in.
+// All methods except reserve() and getPendingCount() must be called
+// on the I/O thread of the connection.
+class Connection : public std::enable_shared_from_this<Connection>
+{
+	public:
+		Connection(
+			boost::asio::io_context &ioc,
+			const boost::asio::ip::tcp::endpoint &ep,
+			LoadToken load_token,
+			ConnectionPool &pool
+		) :
+		m_ioc(ioc),
+		m_sock(ioc),
+		m_ep(ep),
+		m_idle_timer(ioc),
+		m_load_token(std::move(load_token)),
+		m_pool(pool)
+		{}
+
+		boost::asio::io_context &getIoContext()
+		{
+			return m_ioc;
+		}
+
+		const boost::asio::ip::tcp::endpoint &getEndpoint() const
+		{
+			return m_ep;
+		}
+
+		// Number of requests given to the connection
+		// which haven't completed yet.
+		std::size_t getPendingCount() const
+		{
+			return m_pending;
+		}
+
+		// Accounts the request which is going to be sent.
+		void reserve()
+		{
+			++m_pending;
+		}
+
+		void send(std::shared_ptr<BaseSession> session)
+		{
+			if (m_state == State::closed)
+			{
+				complete(std::move(session), m_close_reason);
+				return;
+			}
+			m_idle_timer.cancel();
+
+			// Tag the request with its ID.
+			auto request_buf = session->getWriteBuffer();
+			std::string_view request(
+				static_cast<const char*>(request_buf.data()),
+				request_buf.size()
+			);
+			if (!request.empty() && request.back() == '\n')
+				request.remove_suffix(1);
+
+			auto &&tagged_request = m_write_queue.emplace_back(request);
+			std::array<char, 21u> buffer = { 0 };
+			auto [p, ec] = std::to_chars(
+				buffer.data(),
+				buffer.data() + buffer.size(),
+				session->getID()
+			);
+			tagged_request.append(" #");
+			tagged_request.append(buffer.data(), p - buffer.data());
+			tagged_request.push_back('\n');
+
+			auto id = session->getID();
+			m_in_flight.insert_or_assign(id, std::move(session));
+
+			if (m_state == State::disconnected)
+				connect();
+			else if (m_state == State::connected && m_write_queue.size() == 1)
+				write();
+		}
+
+		// Completes the request right away, its response
+		// will be ignored when it arrives.
+		void abort(std::size_t id)
+		{
+			auto it = m_in_flight.find(id);
+			if (it == m_in_flight.end())
+				return;
+
+			auto session = std::move(it->second);
+			m_in_flight.erase(it);
+			complete(std::move(session), boost::asio::error::operation_aborted);
+		}
+
+		void close()
+		{
+			fail(boost::asio::error::operation_aborted);
+		}
+
+	private:
+		enum class State
+		{
+			disconnected,
+			connecting,
+			connected,
+			closed
+		};
+
+		void connect()
+		{
+			m_state = State::connecting;
+			m_sock.async_connect(
+				m_ep,
+				bindAllocator(
+					HandlerAllocator<void>(m_write_memory),
+					[self=shared_from_this()](auto &&ec)
+					{
+						self->onConnect(ec);
+					}
+				)
+			);
+		}
+
+		void onConnect(const boost::system::error_code &ec)
+		{
+			if (m_state == State::closed)
+				return;
+
+			if (ec)
+			{
+				fail(ec);
+				return;
+			}
+
+			m_state = State::connected;
+			read();
+			if (!m_write_queue.empty())
+				write();
+			else if (m_in_flight.empty())
+				armIdleTimer();
+		}
+
+		void write()
+		{
+			boost::asio::async_write(
+				m_sock,
+				boost::asio::buffer(m_write_queue.front()),
+				bindAllocator(
+					HandlerAllocator<void>(m_write_memory),
+					[self=shared_from_this()](auto &&ec, auto)
+					{
+						self->onWriteComplete(ec);
+					}
+				)
+			);
+		}
+
+		void onWriteComplete(const boost::system::error_code &ec)
+		{
+			if (m_state == State::closed)
+				return;
+
+			if (ec)
+			{
+				fail(ec);
+				return;
+			}
+
+			m_write_queue.pop_front();
+			if (!m_write_queue.empty())
+				write();
+		}
+
+		void read()
+		{
+			boost::asio::async_read_until(
+				m_sock,
+				m_response_buf,
+				'\n',
+				bindAllocator(
+					HandlerAllocator<void>(m_read_memory),
+					[self=shared_from_this()](auto &&ec, auto bt)
+					{
+						self->onResponseReceived(ec, bt);
+					}
+				)
+			);
+		}
+
+		void onResponseReceived(
+			const boost::system::error_code &ec,
+			std::size_t bytes_transferred
+		)
+		{
+			if (m_state == State::closed)
+				return;
+
+			if (ec)
+			{
+				fail(ec);
+				return;
+			}
+
+			// Response line without the delimiter.
+			std::string_view response(
+				static_cast<const char*>(m_response_buf.data().data()),
+				bytes_transferred - 1
+			);
+
+			std::size_t id = 0;
+			auto tag_pos = response.rfind(" #");
+			if (
+				tag_pos != std::string_view::npos &&
+				std::from_chars(
+					response.data() + tag_pos + 2,
+					response.data() + response.size(),
+					id
+				).ec == std::errc()
+			)
+			{
+				if (auto it = m_in_flight.find(id); it != m_in_flight.end())
+				{
+					auto session = std::move(it->second);
+					m_in_flight.erase(it);
+
+					// Session gets the untagged response in place, it's
+					// delivered before the buffer is consumed.
+					session->setResponse(response.substr(0, tag_pos));
+					complete(std::move(session), boost::system::error_code());
+				}
+			}
+
+			m_response_buf.consume(bytes_transferred);
+			read();
+		}
+
+		void complete(
+			std::shared_ptr<BaseSession> session,
+			const boost::system::error_code &ec
+		);
+
+		void armIdleTimer();
+
+		// Closes the connection and fails all requests in flight.
+		void fail(const boost::system::error_code &ec);
+
+	private:
+		boost::asio::io_context &m_ioc;
+		boost::asio::ip::tcp::socket m_sock;
+		boost::asio::ip::tcp::endpoint m_ep;
+		State m_state = State::disconnected;
+		boost::system::error_code m_close_reason;
+
+		// Tagged requests waiting to be written. The first
+		// one is being written.
+		std::deque<PooledString, PoolAllocator<PooledString>> m_write_queue;
+		boost::asio::basic_streambuf<PoolAllocator<char>> m_response_buf;
+
+		// Requests waiting for responses.
+		std::unordered_map<
+			std::size_t,
+			std::shared_ptr<BaseSession>,
+			std::hash<std::size_t>,
+			std::equal_to<std::size_t>,
+			PoolAllocator<std::pair<const std::size_t, std::shared_ptr<BaseSession>>>
+		> m_in_flight;
+		std::atomic<std::size_t> m_pending{0};
+
+		// Closes the connection which has been idle too long.
+		boost::asio::steady_timer m_idle_timer;
+
+		// Connect and write operations are never outstanding
+		// at the same time.
+		HandlerMemory m_write_memory;
+		HandlerMemory m_read_memory;
+
+		LoadToken m_load_token;
+		ConnectionPool &m_pool;
+};
+
+// Persistent connections grouped by server endpoints.
+// Request goes to the connection with fewest pending requests.
+// New connection is opened when every existing one is busy,
+// until there are max_connections to the endpoint.
+class ConnectionPool
+{
+	public:
+		using CompletionHandler = std::function<
+			void (std::shared_ptr<BaseSession>, const boost::system::error_code&)
+		>;
+
+		ConnectionPool(
+			IoContextPool &io_pool,
+			std::size_t max_connections,
+			std::chrono::steady_clock::duration idle_timeout,
+			CompletionHandler on_complete
+		) :
+		m_io_pool(io_pool),
+		m_max_connections(max_connections),
+		m_idle_timeout(idle_timeout),
+		m_on_complete(std::move(on_complete))
+		{
+			assert(0 < max_connections);
+		}
+
+		// Chooses the connection for the request to the endpoint.
+		std::shared_ptr<Connection> acquire(
+			const boost::asio::ip::tcp::endpoint &ep
+		)
+		{
+			std::lock_guard lock(m_guard);
+			auto &&connections = m_connections[ep];
+
+			std::shared_ptr<Connection> connection;
+			for (auto &&c : connections)
+				if (!connection || c->getPendingCount() < connection->getPendingCount())
+					connection = c;
+
+			if (
+				!connection ||
+				(connection->getPendingCount() && connections.size() < m_max_connections)
+			)
+			{
+				auto [ioc, load_token] = m_io_pool.pick();
+				connection = std::make_shared<Connection>(
+					ioc,
+					ep,
+					std::move(load_token),
+					*this
+				);
+				connections.push_back(connection);
+			}
+
+			connection->reserve();
+			return connection;
+		}
+
+		// Forgets the connection, it won't be given to new requests.
+		void remove(Connection &connection)
+		{
+			std::lock_guard lock(m_guard);
+			removeLocked(connection);
+		}
+
+		// Forgets the connection if no request has been given to
+		// it since it became idle. Returns true if it's removed.
+		bool removeIdle(Connection &connection)
+		{
+			// Pending count is incremented by acquire() under the
+			// lock, so the connection can't be given to a request
+			// between the check and the removal.
+			std::lock_guard lock(m_guard);
+			if (connection.getPendingCount())
+				return false;
+
+			removeLocked(connection);
+			return true;
+		}
+
+		// Closes all connections, their requests fail.
+		void close()
+		{
+			std::map<
+				boost::asio::ip::tcp::endpoint,
+				std::vector<std::shared_ptr<Connection>>
+			> connections;
+			{
+				std::lock_guard lock(m_guard);
+				connections.swap(m_connections);
+			}
+
+			for (auto &&[ep, endpoint_connections] : connections)
+				for (auto &&connection : endpoint_connections)
+					boost::asio::post(
+						connection->getIoContext(),
+						[connection]{ connection->close(); }
+					);
+		}
+
+		std::chrono::steady_clock::duration getIdleTimeout() const
+		{
+			return m_idle_timeout;
+		}
+
+		void onComplete(
+			std::shared_ptr<BaseSession> session,
+			const boost::system::error_code &ec
+		)
+		{
+			m_on_complete(std::move(session), ec);
+		}
+
+	private:
+		// Called with m_guard locked.
+		void removeLocked(Connection &connection)
+		{
+			auto it = m_connections.find(connection.getEndpoint());
+			if (it == m_connections.end())
+				return;
+
+			auto &&connections = it->second;
+			connections.erase(
+				std::remove_if(
+					connections.begin(),
+					connections.end(),
+					[&connection](auto &&c){ return c.get() == &connection; }
+				),
+				connections.end()
+			);
+		}
+
+	private:
+		IoContextPool &m_io_pool;
+		const std::size_t m_max_connections;
+		const std::chrono::steady_clock::duration m_idle_timeout;
+		CompletionHandler m_on_complete;
+
+		std::mutex m_guard;
+		std::map<
+			boost::asio::ip::tcp::endpoint,
+			std::vector<std::shared_ptr<Connection>>
+		> m_connections;
+};
+
+inline void Connection::complete(
+	std::shared_ptr<BaseSession> session,
+	const boost::system::error_code &ec
+)
+{
+	--m_pending;
+	m_pool.onComplete(std::move(session), ec);
+
+	if (m_state == State::connected && m_in_flight.empty())
+		armIdleTimer();
+}
+
+inline void Connection::armIdleTimer()
+{
+	m_idle_timer.expires_after(m_pool.getIdleTimeout());
+	m_idle_timer.async_wait(
+		[self=shared_from_this()](auto &&ec)
+		{
+			if (ec || !self->m_in_flight.empty())
+				return;
+
+			if (self->m_pool.removeIdle(*self))
+				self->close();
+		}
+	);
+}
+
+inline void Connection::fail(const boost::system::error_code &ec)
+{
+	if (m_state == State::closed)
+		return;
+
+	m_state = State::closed;
+	m_close_reason = ec;
+	m_pool.remove(*this);
+
+	boost::system::error_code ignored_ec;
+	m_sock.close(ignored_ec);
+	m_idle_timer.cancel();
+	m_write_queue.clear();
+
+	auto in_flight = std::move(m_in_flight);
+	m_in_flight.clear();
+	for (auto &&[id, session] : in_flight)
+		complete(std::move(session), ec);
+}
+
+enum class AdmissionPolicy
+{
+	fail_fast, // Request over the limit fails with try_again.
+	queue      // Request over the limit waits for a free slot.
+};
+
+// Limits of requests in flight, zero means no limit.
+struct AdmissionLimits
+{
+	std::size_t max_in_flight = 0;
+	std::size_t max_in_flight_per_endpoint = 0;
+	AdmissionPolicy policy = AdmissionPolicy::queue;
+	// Request which doesn't fit into the full queue fails fast.
+	std::size_t max_queue_length = 0;
+};
+
+struct AdmissionStats
+{
+	std::size_t in_flight = 0;    // Requests admitted and not complete yet.
+	std::size_t queue_length = 0; // Requests waiting for admission.
+	std::size_t rejected = 0;     // Requests failed fast since the start.
+	std::size_t waited = 0;       // Requests admitted from the queue.
+	std::chrono::steady_clock::duration total_wait{};
+	std::chrono::steady_clock::duration max_wait{};
+};
+
+// Bounds the number of requests in flight globally and per
+// endpoint. Request which doesn't fit either fails fast or waits
+// in the queue. Waiting requests are admitted in the FIFO order,
+// except that those to the endpoint at its limit are passed by
+// requests to other endpoints.
+// Admission starts the request with the resume function given to
+// admit(), completion of the request must be reported with release().
+class AdmissionControl
+{
+	public:
+		explicit AdmissionControl(const AdmissionLimits &limits) :
+		m_limits(limits)
+		{}
+
+		// Calls resume with no error if the request is admitted
+		// and with try_again if it's rejected. Resume of the queued
+		// request is called later, by release() or cancel().
+		// It's never called under the lock.
+		template <class Resume>
+		void admit(
+			std::size_t request_id,
+			const boost::asio::ip::tcp::endpoint &ep,
+			Resume &&resume
+		)
+		{
+			std::unique_lock lock(m_guard);
+			auto &&endpoint = m_endpoints[ep];
+			// Request doesn't pass those waiting for the same endpoint.
+			if (!m_closed && endpoint.waiting.empty() && hasRoom(endpoint))
+			{
+				++m_in_flight;
+				++endpoint.in_flight;
+				lock.unlock();
+				resume(boost::system::error_code());
+				return;
+			}
+
+			if (
+				m_closed ||
+				m_limits.policy == AdmissionPolicy::fail_fast ||
+				(m_limits.max_queue_length && m_queue_length == m_limits.max_queue_length)
+			)
+			{
+				++m_rejected;
+				lock.unlock();
+				resume(boost::asio::error::try_again);
+				return;
+			}
+
+			endpoint.waiting.push_back(
+				std::make_unique<Waiter<std::decay_t<Resume>>>(
+					request_id,
+					m_next_seq++,
+					std::forward<Resume>(resume)
+				)
+			);
+			++m_queue_length;
+		}
+
+		// Frees the slot of the complete request and admits
+		// the next waiting request which fits.
+		void release(const boost::asio::ip::tcp::endpoint &ep)
+		{
+			std::unique_lock lock(m_guard);
+			--m_in_flight;
+			--m_endpoints[ep].in_flight;
+
+			auto waiter = takeNext();
+			lock.unlock();
+
+			if (waiter)
+				waiter->resume(boost::system::error_code());
+		}
+
+		// Fails the waiting request with operation_aborted.
+		// Returns false if the request isn't waiting.
+		bool cancel(std::size_t request_id)
+		{
+			std::unique_lock lock(m_guard);
+			if (!m_queue_length)
+				return false;
+
+			for (auto &&[ep, endpoint] : m_endpoints)
+			{
+				auto &&waiting = endpoint.waiting;
+				auto it = std::find_if(
+					waiting.begin(),
+					waiting.end(),
+					[request_id](auto &&w){ return w->request_id == request_id; }
+				);
+				if (it == waiting.end())
+					continue;
+
+				auto waiter = std::move(*it);
+				waiting.erase(it);
+				--m_queue_length;
+				lock.unlock();
+
+				waiter->resume(boost::asio::error::operation_aborted);
+				return true;
+			}
+			return false;
+		}
+
+		// Fails all waiting requests with operation_aborted,
+		// new requests are rejected.
+		void close()
+		{
+			std::vector<std::unique_ptr<IWaiter>> waiters;
+			{
+				std::lock_guard lock(m_guard);
+				m_closed = true;
+				while (auto waiter = takeFirst())
+					waiters.push_back(std::move(waiter));
+			}
+
+			for (auto &&waiter : waiters)
+				waiter->resume(boost::asio::error::operation_aborted);
+		}
+
+		AdmissionStats getStats()
+		{
+			std::lock_guard lock(m_guard);
+			AdmissionStats stats;
+			stats.in_flight = m_in_flight;
+			stats.queue_length = m_queue_length;
+			stats.rejected = m_rejected;
+			stats.waited = m_waited;
+			stats.total_wait = m_total_wait;
+			stats.max_wait = m_max_wait;
+			return stats;
+		}
+
+	private:
+		class IWaiter
+		{
+			public:
+				IWaiter(std::size_t request_id, std::uint64_t seq) :
+				request_id(request_id),
+				seq(seq)
+				{}
+
+				virtual ~IWaiter() = default;
+
+				virtual void resume(const boost::system::error_code &ec) = 0;
+
+				const std::size_t request_id;
+				const std::uint64_t seq; // Position in the FIFO order.
+				const std::chrono::steady_clock::time_point enqueued_at =
+					std::chrono::steady_clock::now();
+		};
+
+		template <class Resume>
+		class Waiter final : public IWaiter
+		{
+			public:
+				Waiter(std::size_t request_id, std::uint64_t seq, Resume &&resume) :
+				IWaiter(request_id, seq),
+				m_resume(std::move(resume))
+				{}
+
+				void resume(const boost::system::error_code &ec) override
+				{
+					m_resume(ec);
+				}
+
+			private:
+				Resume m_resume;
+		};
+
+		struct Endpoint
+		{
+			std::size_t in_flight = 0;
+			std::deque<std::unique_ptr<IWaiter>> waiting;
+		};
+
+		bool hasRoom(const Endpoint &endpoint) const
+		{
+			return
+				(!m_limits.max_in_flight || m_in_flight < m_limits.max_in_flight) &&
+				(
+					!m_limits.max_in_flight_per_endpoint ||
+					endpoint.in_flight < m_limits.max_in_flight_per_endpoint
+				);
+		}
+
+		// Dequeues the earliest waiting request which fits
+		// into the limits and accounts it in flight.
+		std::unique_ptr<IWaiter> takeNext()
+		{
+			if (m_closed || !m_queue_length)
+				return nullptr;
+
+			Endpoint *next = nullptr;
+			for (auto &&[ep, endpoint] : m_endpoints)
+			{
+				if (endpoint.waiting.empty() || !hasRoom(endpoint))
+					continue;
+				if (!next || endpoint.waiting.front()->seq < next->waiting.front()->seq)
+					next = &endpoint;
+			}
+			if (!next)
+				return nullptr;
+
+			auto waiter = std::move(next->waiting.front());
+			next->waiting.pop_front();
+			--m_queue_length;
+			++m_in_flight;
+			++next->in_flight;
+
+			auto wait = std::chrono::steady_clock::now() - waiter->enqueued_at;
+			++m_waited;
+			m_total_wait += wait;
+			m_max_wait = std::max(m_max_wait, wait);
+			return waiter;
+		}
+
+		// Dequeues the earliest waiting request ignoring the limits.
+		std::unique_ptr<IWaiter> takeFirst()
+		{
+			Endpoint *first = nullptr;
+			for (auto &&[ep, endpoint] : m_endpoints)
+				if (
+					!endpoint.waiting.empty() &&
+					(!first || endpoint.waiting.front()->seq < first->waiting.front()->seq)
+				)
+					first = &endpoint;
+			if (!first)
+				return nullptr;
+
+			auto waiter = std::move(first->waiting.front());
+			first->waiting.pop_front();
+			--m_queue_length;
+			return waiter;
+		}
+
+	private:
+		const AdmissionLimits m_limits;
+
+		std::mutex m_guard;
+		std::map<boost::asio::ip::tcp::endpoint, Endpoint> m_endpoints;
+		std::size_t m_in_flight = 0;
+		std::size_t m_queue_length = 0;
+		std::uint64_t m_next_seq = 0;
+		bool m_closed = false;
+
+		std::size_t m_rejected = 0;
+		std::size_t m_waited = 0;
+		std::chrono::steady_clock::duration m_total_wait{};
+		std::chrono::steady_clock::duration m_max_wait{};
+};
+
+struct HedgingPolicy
+{
+	// Duplicate request is sent when the request hasn't completed
+	// within this percentile of the recent latencies.
+	double percentile = 0.95;
+	// Delay used until enough latencies are recorded.
+	std::chrono::steady_clock::duration initial_delay = std::chrono::milliseconds(100);
+	std::chrono::steady_clock::duration min_delay = std::chrono::milliseconds(1);
+	// Average number of duplicates per hedged request at most.
+	double max_extra_load = 0.05;
+};
+
+// Decides when to send duplicate requests and bounds their number.
+// Duplicates are paid from the budget which every hedged request
+// tops up by max_extra_load, so they add at most that share of
+// requests however slow the servers become.
+class HedgingControl
+{
+	public:
+		explicit HedgingControl(const HedgingPolicy &policy) :
+		m_policy(policy),
+		m_deposit(static_cast<std::int64_t>(policy.max_extra_load * TOKEN))
+		{}
+
+		std::chrono::steady_clock::duration getDelay() const
+		{
+			if (m_latencies.getCount() < MIN_SAMPLES)
+				return m_policy.initial_delay;
+
+			return std::max(
+				m_policy.min_delay,
+				m_latencies.getPercentile(m_policy.percentile)
+			);
+		}
+
+		// Latency of the request which has completed successfully.
+		void record(std::chrono::steady_clock::duration latency)
+		{
+			m_latencies.record(latency);
+		}
+
+		void deposit()
+		{
+			auto budget = m_budget.load(std::memory_order_relaxed);
+			while (
+				budget < MAX_BUDGET &&
+				!m_budget.compare_exchange_weak(
+					budget,
+					std::min(budget + m_deposit, MAX_BUDGET),
+					std::memory_order_relaxed
+				)
+			);
+		}
+
+		// Returns false if the budget doesn't allow one more duplicate.
+		bool withdraw()
+		{
+			auto budget = m_budget.load(std::memory_order_relaxed);
+			while (budget >= TOKEN)
+			{
+				if (m_budget.compare_exchange_weak(budget, budget - TOKEN, std::memory_order_relaxed))
+					return true;
+			}
+			return false;
+		}
+
+	private:
+		// Budget is kept in thousandths of a duplicate. It starts
+		// full, so the first slow requests are hedged too.
+		constexpr inline static std::int64_t TOKEN = 1000;
+		constexpr inline static std::int64_t MAX_BUDGET = 10 * TOKEN;
+		constexpr inline static std::uint64_t MIN_SAMPLES = 32;
+
+		const HedgingPolicy m_policy;
+		const std::int64_t m_deposit;
+		std::atomic<std::int64_t> m_budget{MAX_BUDGET};
+		LatencyHistogram m_latencies;
+};
+
+class AsyncTCPClient
+{
+	public:
+		// C++ noncopyable and nonmoveable 
+		AsyncTCPClient(const AsyncTCPClient&) = delete;
+		AsyncTCPClient &operator=(const AsyncTCPClient&) = delete;
+
+		// Callbacks are invoked from io_threads_count I/O threads,
+		// so they must be thread safe if io_threads_count > 1.
+		explicit AsyncTCPClient(
+			std::size_t io_threads_count = 1,
+			IoContextPool::Placement placement =
+				IoContextPool::Placement::round_robin
+		) :
+		m_io_pool(io_threads_count, placement)
+		{}
+
+		// Makes requests to the same server share persistent
+		// connections, at most max_connections_per_endpoint of them.
+		// Connection is closed after it has been idle for
+		// idle_timeout. The server must support tagged requests.
+		// Must be called before the first request.
+		void enableConnectionPooling(
+			std::size_t max_connections_per_endpoint,
+			std::chrono::steady_clock::duration idle_timeout
+		)
+		{
+			m_connection_pool = std::make_unique<ConnectionPool>(
+				m_io_pool,
+				max_connections_per_endpoint,
+				idle_timeout,
+				[this](auto &&session, auto &&ec)
+				{
+					bool cancelled = session->isSessionWasCancelled();
+					onRequestComplete(std::move(session), ec, cancelled);
+				}
+			);
+		}
+
+		// Bounds the number of requests in flight. Requests over the
+		// limits fail with try_again or wait for admission according
+		// to the policy. Must be called before the first request.
+		void setAdmissionLimits(const AdmissionLimits &limits)
+		{
+			m_admission = std::make_unique<AdmissionControl>(limits);
+		}
+
+		AdmissionStats getAdmissionStats()
+		{
+			return m_admission ? m_admission->getStats() : AdmissionStats();
+		}
+
+		template< class Rep, class Period, class Callback >
+		void emulateLongComputationOp(
+			const std::chrono::duration<Rep, Period>& duration,
+			std::string_view raw_ip_address,
+			std::uint16_t port_num,
+			Callback &&callback,
+			std::size_t request_id,
+			const RequestDeadlines &deadlines = RequestDeadlines()
+		)
+		{
+			boost::asio::ip::tcp::endpoint ep(
+				boost::asio::ip::make_address(raw_ip_address),
+				port_num
+			);
+			auto request = makeRequest(
+				std::chrono::duration_cast<std::chrono::seconds>(duration)
+			);
+
+			admitAndSubmit(
+				ep,
+				std::move(request),
+				std::forward<Callback>(callback),
+				request_id,
+				deadlines
+			);
+		}
+
+		struct ServerAddress
+		{
+			std::string raw_ip_address;
+			std::uint16_t port_num;
+		};
+
+		// Duplicate of the hedged request has the ID with this bit
+		// set, IDs of user requests must not have it.
+		constexpr inline static std::size_t HEDGE_ID_BIT =
+			std::size_t(1) << (std::numeric_limits<std::size_t>::digits - 1);
+
+		// Enables emulateHedgedOp(). Must be called before the first request.
+		void enableHedging(const HedgingPolicy &policy)
+		{
+			m_hedging = std::make_unique<HedgingControl>(policy);
+		}
+
+		// Sends the request to the primary server. If it hasn't
+		// completed within the latency set by the hedging policy,
+		// the duplicate is sent to the alternate server. Callback gets
+		// the response which arrives first and the other request is
+		// cancelled. Failure is reported when both requests fail.
+		template< class Rep, class Period, class Callback >
+		void emulateHedgedOp(
+			const std::chrono::duration<Rep, Period>& duration,
+			const ServerAddress &primary,
+			const ServerAddress &alternate,
+			Callback &&callback,
+			std::size_t request_id,
+			const RequestDeadlines &deadlines = RequestDeadlines()
+		)
+		{
+			assert(m_hedging && !(request_id & HEDGE_ID_BIT));
+
+			boost::asio::ip::tcp::endpoint primary_ep(
+				boost::asio::ip::make_address(primary.raw_ip_address),
+				primary.port_num
+			);
+			boost::asio::ip::tcp::endpoint alternate_ep(
+				boost::asio::ip::make_address(alternate.raw_ip_address),
+				alternate.port_num
+			);
+
+			// Hedge timer is tracked by the timing wheel
+			// of one of the I/O threads.
+			auto [timer_ioc, load_token] = m_io_pool.pick();
+
+			using State = HedgedRequest<std::decay_t<Callback>>;
+			auto state = std::allocate_shared<State>(
+				PoolAllocator<State>(),
+				std::forward<Callback>(callback),
+				request_id,
+				std::chrono::duration_cast<std::chrono::seconds>(duration),
+				alternate_ep,
+				deadlines,
+				timer_ioc
+			);
+			m_hedging->deposit();
+			m_hedged_requests.insert(request_id, state);
+
+			admitAndSubmit(
+				primary_ep,
+				makeRequest(state->duration),
+				makeHedgedAttemptCallback(state, false),
+				request_id,
+				deadlines
+			);
+
+			auto delay = m_hedging->getDelay();
+			boost::asio::post(
+				timer_ioc,
+				bindAllocator(
+					PoolAllocator<void>(),
+					[this, state, delay]
+					{
+						std::lock_guard lock(state->guard);
+						if (state->completed)
+							return;
+
+						boost::asio::use_service<TimingWheel>(state->timer_ioc).schedule(
+							state->timer,
+							delay,
+							[this, state]{ sendHedge(state); }
+						);
+					}
+				)
+			);
+		}
+
+		// Request of the batch given to submitBatch().
+		struct Request
+		{
+			std::chrono::seconds duration;
+			std::string_view raw_ip_address;
+			std::uint16_t port_num;
+			std::size_t request_id;
+			RequestDeadlines deadlines;
+		};
+
+		// Submits count requests at once, callback is called on
+		// completion of every one of them. Sessions of the batch are
+		// allocated in a single block and added to the registry
+		// locking every its shard once. Batch is split over the I/O
+		// threads, each of them gets one handler which starts its
+		// part of the batch. Memory of the sessions is freed when the
+		// whole batch completes. Over pooled connections and with
+		// admission limits requests are submitted one by one.
+		template <class Callback>
+		void submitBatch(const Request *requests, std::size_t count, Callback callback)
+		{
+			if (!count)
+				return;
+
+			if (m_connection_pool || m_admission)
+			{
+				for (std::size_t i = 0; i != count; ++i)
+				{
+					auto &&r = requests[i];
+					emulateLongComputationOp(
+						r.duration,
+						r.raw_ip_address,
+						r.port_num,
+						callback,
+						r.request_id,
+						r.deadlines
+					);
+				}
+				return;
+			}
+
+			using SessionType = Session<Callback>;
+			auto batch = std::make_shared<SessionBatch<SessionType>>(count);
+
+			// Every I/O thread gets a contiguous part of the batch.
+			auto parts_count = std::min(count, m_io_pool.size());
+			std::vector<boost::asio::io_context*> part_iocs;
+			part_iocs.reserve(parts_count);
+			for (std::size_t part = 0; part != parts_count; ++part)
+			{
+				auto [ioc, load_token] = m_io_pool.pick();
+				part_iocs.push_back(&ioc);
+
+				auto last = (part + 1) * count / parts_count;
+				for (auto i = part * count / parts_count; i != last; ++i)
+				{
+					auto &&r = requests[i];
+					auto &&session = batch->emplace(
+						ioc,
+						boost::asio::ip::tcp::endpoint(
+							boost::asio::ip::make_address(r.raw_ip_address),
+							r.port_num
+						),
+						makeRequest(r.duration),
+						r.request_id,
+						Callback(callback),
+						load_token.share()
+					);
+					session.setDeadlines(r.deadlines);
+				}
+			}
+
+			std::vector<std::pair<std::size_t, std::shared_ptr<BaseSession>>> entries;
+			entries.reserve(count);
+			for (std::size_t i = 0; i != count; ++i)
+			{
+				auto &&session = (*batch)[i];
+				entries.emplace_back(
+					session.getID(),
+					std::shared_ptr<BaseSession>(batch, &session)
+				);
+			}
+			m_active_sessions.insert(
+				std::make_move_iterator(entries.begin()),
+				std::make_move_iterator(entries.end())
+			);
+
+			for (std::size_t part = 0; part != parts_count; ++part)
+			{
+				auto first = part * count / parts_count;
+				auto last = (part + 1) * count / parts_count;
+				boost::asio::post(
+					*part_iocs[part],
+					bindAllocator(
+						PoolAllocator<void>(),
+						[this, batch, first, last]
+						{
+							for (auto i = first; i != last; ++i)
+								startRequest(std::shared_ptr<SessionType>(batch, &(*batch)[i]));
+						}
+					)
+				);
+			}
+		}
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+		// Coroutine interface, it's available when the example is
+		// compiled as C++20. Asio 1.74 has no cancellation slots, so
+		// requests are cancelled by their IDs with cancelRequest()
+		// and the awaiting coroutine gets operation_aborted.
+
+		// Awaitable form of emulateLongComputationOp. Returns the
+		// response, throws boost::system::system_error on failure.
+		template <class Rep, class Period>
+		boost::asio::awaitable<std::string> asyncEmulateLongComputationOp(
+			std::chrono::duration<Rep, Period> duration,
+			std::string raw_ip_address,
+			std::uint16_t port_num,
+			std::size_t request_id,
+			RequestDeadlines deadlines = RequestDeadlines()
+		)
+		{
+			return boost::asio::async_initiate<
+				const boost::asio::use_awaitable_t<>&,
+				void (boost::system::error_code, std::string)
+			>(
+				[this, duration, raw_ip_address=std::move(raw_ip_address), port_num, request_id, deadlines](
+					auto handler
+				)
+				{
+					// Keeps the executor of the coroutine running
+					// while the request is in flight.
+					auto work = boost::asio::make_work_guard(handler);
+					emulateLongComputationOp(
+						duration,
+						raw_ip_address,
+						port_num,
+						[handler=std::move(handler), work=std::move(work)](
+							std::size_t id,
+							std::string_view response,
+							const boost::system::error_code &ec
+						) mutable
+						{
+							// Resume the coroutine on its own executor.
+							auto executor = work.get_executor();
+							boost::asio::dispatch(
+								executor,
+								[handler=std::move(handler), ec, response=std::string(response)]() mutable
+								{
+									handler(ec, std::move(response));
+								}
+							);
+						},
+						request_id,
+						deadlines
+					);
+				},
+				boost::asio::use_awaitable
+			);
+		}
+
+		struct Response
+		{
+			std::size_t request_id;
+			std::string response;
+		};
+
+		// Sends the request to every server and returns the first
+		// k responses in the order they have arrived. Request to
+		// servers[i] gets ID first_request_id + i. Requests still
+		// running are cancelled. Throws the error of the last failed
+		// request if fewer than k requests succeed. For example:
+		//   auto responses = co_await client.asyncFirstResponses(
+		//       5s, {{"10.0.0.1", 3333}, {"10.0.0.2", 3333}, {"10.0.0.3", 3333}}, 100, 2
+		//   );
+		template <class Rep, class Period>
+		boost::asio::awaitable<std::vector<Response>> asyncFirstResponses(
+			std::chrono::duration<Rep, Period> duration,
+			std::vector<ServerAddress> servers,
+			std::size_t first_request_id,
+			std::size_t k,
+			RequestDeadlines deadlines = RequestDeadlines()
+		)
+		{
+			assert(k <= servers.size());
+
+			return boost::asio::async_initiate<
+				const boost::asio::use_awaitable_t<>&,
+				void (boost::system::error_code, std::vector<Response>)
+			>(
+				[this, duration, servers=std::move(servers), first_request_id, k, deadlines](
+					auto handler
+				)
+				{
+					using handler_type = decltype(handler);
+					using work_type = decltype(boost::asio::make_work_guard(handler));
+
+					// Requests complete on different I/O threads.
+					struct State
+					{
+						State(handler_type &&handler) :
+						work(boost::asio::make_work_guard(handler)),
+						handler(std::move(handler))
+						{}
+
+						std::mutex guard;
+						work_type work;
+						std::optional<handler_type> handler;
+						std::vector<Response> responses;
+						std::size_t failed = 0;
+						boost::system::error_code last_error;
+					};
+
+					auto state = std::make_shared<State>(std::move(handler));
+					auto count = servers.size();
+					for (std::size_t i = 0; i != count; ++i)
+					{
+						{
+							std::lock_guard lock(state->guard);
+							if (!state->handler)
+								break;
+						}
+
+						emulateLongComputationOp(
+							duration,
+							servers[i].raw_ip_address,
+							servers[i].port_num,
+							[this, state, first_request_id, count, k](
+								std::size_t id,
+								std::string_view response,
+								const boost::system::error_code &ec
+							)
+							{
+								std::unique_lock lock(state->guard);
+								if (!state->handler)
+									return;
+
+								if (!ec)
+								{
+									state->responses.push_back({id, std::string(response)});
+								}
+								else
+								{
+									++state->failed;
+									state->last_error = ec;
+								}
+
+								bool succeeded = state->responses.size() == k;
+								if (!succeeded && state->failed <= count - k)
+									return;
+
+								auto handler = std::move(*state->handler);
+								state->handler.reset();
+								auto responses = std::move(state->responses);
+								auto result_ec = succeeded ?
+									boost::system::error_code() :
+									state->last_error;
+								auto executor = state->work.get_executor();
+								lock.unlock();
+
+								// Requests which have completed
+								// are not in the registry already.
+								for (std::size_t j = 0; j != count; ++j)
+									cancelRequest(first_request_id + j);
+
+								boost::asio::dispatch(
+									executor,
+									[handler=std::move(handler), result_ec, responses=std::move(responses)]() mutable
+									{
+										handler(result_ec, std::move(responses));
+									}
+								);
+							},
+							first_request_id + i,
+							deadlines
+						);
+					}
+				},
+				boost::asio::use_awaitable
+			);
+		}
+#endif
+
+		void cancelRequest(std::size_t request_id)
+		{
+			if (m_hedging)
+			{
+				// Duplicate which hasn't been submitted yet
+				// can't be cancelled, it mustn't be sent.
+				std::shared_ptr<HedgedRequestBase> state;
+				m_hedged_requests.visit(
+					request_id,
+					[&state](auto &&s)
+					{
+						state = s;
+					}
+				);
+				if (state)
+				{
+					std::lock_guard lock(state->guard);
+					state->cancelled = true;
+				}
+			}
+
+			cancelAttempt(request_id);
+			if (m_hedging)
+				cancelAttempt(request_id | HEDGE_ID_BIT);
+		}
+
+		void close()
+		{
+			if (m_admission)
+				m_admission->close();
+			if (m_connection_pool)
+				m_connection_pool->close();
+
+			m_io_pool.stop();
+		}
+
+	private:
+		// State of the hedged request shared with cancelRequest().
+		struct HedgedRequestBase
+		{
+			std::mutex guard;
+			bool completed = false;
+			bool cancelled = false;
+		};
+
+		// Hedged request, its original and duplicate attempts.
+		template <class Callback>
+		struct HedgedRequest : HedgedRequestBase
+		{
+			template <class CallbackArg>
+			HedgedRequest(
+				CallbackArg &&callback,
+				std::size_t request_id,
+				std::chrono::seconds duration,
+				const boost::asio::ip::tcp::endpoint &alternate,
+				const RequestDeadlines &deadlines,
+				boost::asio::io_context &timer_ioc
+			) :
+			callback(std::forward<CallbackArg>(callback)),
+			request_id(request_id),
+			duration(duration),
+			alternate(alternate),
+			deadlines(deadlines),
+			timer_ioc(timer_ioc)
+			{}
+
+			bool hedged = false;
+			std::size_t outstanding = 1; // Attempts which haven't failed.
+
+			Callback callback;
+			const std::size_t request_id;
+			const std::chrono::seconds duration;
+			const boost::asio::ip::tcp::endpoint alternate;
+			const RequestDeadlines deadlines;
+
+			std::chrono::steady_clock::time_point started_at =
+				std::chrono::steady_clock::now();
+			std::chrono::steady_clock::time_point hedged_at;
+
+			// Timer is used on the thread of timer_ioc only.
+			boost::asio::io_context &timer_ioc;
+			TimingWheel::Timer timer;
+		};
+
+		template <class State>
+		auto makeHedgedAttemptCallback(const std::shared_ptr<State> &state, bool is_hedge)
+		{
+			return [this, state, is_hedge](
+				std::size_t id,
+				std::string_view response,
+				const boost::system::error_code &ec
+			)
+			{
+				onHedgedAttemptComplete(state, is_hedge, response, ec);
+			};
+		}
+
+		// Runs on the thread of the timer when the request is slow.
+		template <class State>
+		void sendHedge(const std::shared_ptr<State> &state)
+		{
+			{
+				std::lock_guard lock(state->guard);
+				if (state->completed || state->cancelled || !m_hedging->withdraw())
+					return;
+
+				state->hedged = true;
+				state->hedged_at = std::chrono::steady_clock::now();
+				++state->outstanding;
+			}
+
+			admitAndSubmit(
+				state->alternate,
+				makeRequest(state->duration),
+				makeHedgedAttemptCallback(state, true),
+				state->request_id | HEDGE_ID_BIT,
+				state->deadlines
+			);
+
+			// Request cancelled while the duplicate was being
+			// submitted didn't find it, it's cancelled here.
+			{
+				std::lock_guard lock(state->guard);
+				if (!state->cancelled)
+					return;
+			}
+			cancelAttempt(state->request_id | HEDGE_ID_BIT);
+		}
+
+		// Response of the attempt which completes first is delivered,
+		// failed attempt waits for the other one if it's running.
+		// Cancelled request completes with operation_aborted as soon
+		// as any of its attempts does.
+		template <class State>
+		void onHedgedAttemptComplete(
+			const std::shared_ptr<State> &state,
+			bool is_hedge,
+			std::string_view response,
+			const boost::system::error_code &ec
+		)
+		{
+			auto now = std::chrono::steady_clock::now();
+			bool hedged = false;
+			bool cancelled = false;
+			{
+				std::lock_guard lock(state->guard);
+				if (
+					state->completed ||
+					(ec && !state->cancelled && --state->outstanding)
+				)
+					return;
+
+				state->completed = true;
+				hedged = state->hedged;
+				cancelled = state->cancelled;
+			}
+			m_hedged_requests.erase(state->request_id);
+
+			if (!ec && !cancelled)
+				m_hedging->record(now - (is_hedge ? state->hedged_at : state->started_at));
+
+			// Cancel the loser and the hedge timer.
+			if (hedged)
+				cancelAttempt(is_hedge ? state->request_id : state->request_id | HEDGE_ID_BIT);
+			boost::asio::post(
+				state->timer_ioc,
+				bindAllocator(
+					PoolAllocator<void>(),
+					[state]{ state->timer.cancel(); }
+				)
+			);
+
+			if (cancelled)
+			{
+				invokeResponseCallback(
+					state->callback,
+					state->request_id,
+					std::string_view(),
+					boost::asio::error::operation_aborted
+				);
+				return;
+			}
+			invokeResponseCallback(state->callback, state->request_id, response, ec);
+		}
+
+		void cancelAttempt(std::size_t request_id)
+		{
+			std::shared_ptr<BaseSession> session;
+			m_active_sessions.visit(
+				request_id,
+				[&session](auto &&s)
+				{
+					session = s;
+				}
+			);
+
+			if (!session)
+			{
+				// Request may be waiting for admission.
+				if (m_admission)
+					m_admission->cancel(request_id);
+				return;
+			}
+
+			// Socket must be cancelled on the I/O thread
+			// the session is bound to.
+			auto executor = session->getExecutor();
+			boost::asio::post(
+				executor,
+				bindAllocator(
+					PoolAllocator<void>(),
+					[session=std::move(session)]
+					{
+						session->cancel();
+						if (auto connection = session->getConnection())
+							connection->abort(session->getID());
+					}
+				)
+			);
+		}
+
+		// Submits the request when admission control lets it in.
+		template <class Callback>
+		void admitAndSubmit(
+			const boost::asio::ip::tcp::endpoint &ep,
+			PooledString request,
+			Callback &&callback,
+			std::size_t request_id,
+			const RequestDeadlines &deadlines
+		)
+		{
+			if (!m_admission)
+			{
+				submit(
+					ep,
+					std::move(request),
+					std::forward<Callback>(callback),
+					request_id,
+					deadlines
+				);
+				return;
+			}
+
+			// Admitted request is submitted right away, the waiting
+			// one is submitted on completion of another request.
+			m_admission->admit(
+				request_id,
+				ep,
+				[this, ep, request=std::move(request), callback=std::forward<Callback>(callback), request_id, deadlines](
+					const boost::system::error_code &ec
+				) mutable
+				{
+					if (ec)
+						failRequest(std::move(callback), request_id, ec);
+					else
+						submit(ep, std::move(request), std::move(callback), request_id, deadlines);
+				}
+			);
+		}
+
+		template <class Callback>
+		void submit(
+			const boost::asio::ip::tcp::endpoint &ep,
+			PooledString request,
+			Callback &&callback,
+			std::size_t request_id,
+			const RequestDeadlines &deadlines
+		)
+		{
+			if (m_connection_pool)
+			{
+				// Send the request over the pooled connection.
+				auto connection = m_connection_pool->acquire(ep);
+				std::shared_ptr<BaseSession> session = std::allocate_shared<Session<Callback>>(
+					PoolAllocator<Session<Callback>>(),
+					connection->getIoContext(),
+					ep,
+					std::move(request),
+					request_id,
+					std::forward<Callback>(callback),
+					LoadToken()
+				);
+				session->setConnection(connection);
+				session->setDeadlines(deadlines);
+				m_active_sessions.insert(request_id, session);
+
+				auto &&ioc = connection->getIoContext();
+				auto allocator = session->getHandlerAllocator();
+				boost::asio::post(
+					ioc,
+					bindAllocator(
+						allocator,
+						[connection=std::move(connection), session=std::move(session)]() mutable
+						{
+							auto &&deadlines = session->getDeadlines();
+							session->armOverallDeadline(
+								deadlines.overall,
+								makeDeadlineHandler(session.get())
+							);
+							session->armPhaseDeadline(
+								deadlines.read,
+								makeDeadlineHandler(session.get())
+							);
+							connection->send(std::move(session));
+						}
+					)
+				);
+				return;
+			}
+
+			auto [ioc, load_token] = m_io_pool.pick();
+			// Session and its shared_ptr control block share
+			// the single block of the pooled memory. The request
+			// chain keeps the concrete session type, so its steps
+			// and the callback are resolved at compile time.
+			auto session = std::allocate_shared<Session<Callback>>(
+				PoolAllocator<Session<Callback>>(),
+				ioc,
+				ep,
+				std::move(request),
+				request_id,
+				std::forward<Callback>(callback),
+				std::move(load_token)
+			);
+
+			// Add new session to the registry of active sessions so
+			// that we can access it if the user decides to cannel
+			// the corresponding request before if completes.
+			// Registry can be accessed from multiple threads, it
+			// guards every its shard with a separate mutex.
+			session->setDeadlines(deadlines);
+			m_active_sessions.insert(request_id, session);
+
+			// Deadlines are armed on the I/O thread of the session.
+			// I/O thread doesn't use the handler memory of the
+			// session until it runs this handler.
+			auto allocator = session->getHandlerAllocator();
+			boost::asio::post(
+				ioc,
+				bindAllocator(
+					allocator,
+					[this, session=std::move(session)]() mutable
+					{
+						startRequest(std::move(session));
+					}
+				)
+			);
+		}
+
+		// Reports the request which hasn't been submitted.
+		// Callbacks are invoked on the I/O threads only.
+		template <class Callback>
+		void failRequest(
+			Callback &&callback,
+			std::size_t request_id,
+			const boost::system::error_code &ec
+		)
+		{
+			auto [ioc, load_token] = m_io_pool.pick();
+			boost::asio::post(
+				ioc,
+				bindAllocator(
+					PoolAllocator<void>(),
+					[callback=std::forward<Callback>(callback), request_id, ec]() mutable
+					{
+						callback(request_id, std::string(), ec);
+					}
+				)
+			);
+		}
+
+		// Request string for the operation of the given duration.
+		static PooledString makeRequest(std::chrono::seconds duration)
+		{
+			PooledString request;
+			request.reserve(42);
+			std::array<char, 21u> buffer = { 0 }; // 20 is str length of int64_max with sign and 1 for zero termination
+			if (auto[p, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), duration.count()); ec == std::errc())
+			{
+				request = m_op_name;
+				request.append(buffer.data(), p - buffer.data());
+				request.push_back('\n');
+			}
+			return request;
+		}
+
+		// Returns the callback of the timing wheel which aborts
+		// the request when it misses the deadline. Session owns
+		// the timers, so it's alive while they are armed.
+		static auto makeDeadlineHandler(BaseSession *session)
+		{
+			return [session]
+			{
+				session->timeOut();
+				if (auto connection = session->getConnection())
+					connection->abort(session->getID());
+			};
+		}
+
+		// Steps of the request chain are templates over the session
+		// type. They are instantiated for Session<Callback> of every
+		// callback type and for BaseSession, which invokes the
+		// callback virtually, where the type is unknown.
+		template <class SessionType>
+		void startRequest(std::shared_ptr<SessionType> session)
+		{
+			auto &&deadlines = session->getDeadlines();
+			session->armOverallDeadline(
+				deadlines.overall,
+				makeDeadlineHandler(session.get())
+			);
+			session->armPhaseDeadline(
+				deadlines.connect,
+				makeDeadlineHandler(session.get())
+			);
+
+			auto session_raw_ptr = session.get();
+			session_raw_ptr->asyncConnect(
+				[this, session=std::move(session)](auto &&ec) mutable
+				{
+					onConnect(std::move(session), ec);
+				}
+			);
+		}
+
+		template <class SessionType>
+		void onConnect(
+			std::shared_ptr<SessionType> session, 
+			const boost::system::error_code &ec
+		)
+		{
+			if (ec)
+			{
+				onRequestComplete(std::move(session), ec);
+				return;
+			}
+
+			if (bool cancelled = session->isSessionWasCancelled(); cancelled)
+			{
+				onRequestComplete(std::move(session), ec, cancelled);
+				return;
+			}
+
+			session->armPhaseDeadline(
+				session->getDeadlines().write,
+				makeDeadlineHandler(session.get())
+			);
+
+			auto session_raw_ptr = session.get();
+			session_raw_ptr->asyncWrite(
+				[this, session=std::move(session)](auto &&ec, auto bt) mutable
+				{
+					onWriteComplete(std::move(session), ec, bt);
+				}
+			);
+		}
+
+		template <class SessionType>
+		void onWriteComplete(
+			std::shared_ptr<SessionType> session, 
+			const boost::system::error_code &ec,
+			std::size_t bytes_transferred
+		)
+		{
+			std::ignore = bytes_transferred;
+			if (ec)
+			{
+				onRequestComplete(std::move(session), ec);
+				return;
+			}
+
+			if (bool cancelled = session->isSessionWasCancelled(); cancelled)
+			{
+				onRequestComplete(std::move(session), ec, cancelled);
+				return;
+			}
+
+			session->armPhaseDeadline(
+				session->getDeadlines().read,
+				makeDeadlineHandler(session.get())
+			);
+
+			auto session_raw_ptr = session.get();
+			session_raw_ptr->asyncReadUntil(
+				"\n",
+				[this, session=std::move(session)](auto &&ec, auto bt) mutable
+				{
+					bool cancelled = session->isSessionWasCancelled();
+					onRequestComplete(std::move(session), ec, cancelled);
+				}
+			);
+		}
+
+		template <class SessionType>
+		void onRequestComplete(
+			std::shared_ptr<SessionType> session, 
+			const boost::system::error_code &ec,
+			bool cancelled = false
+		)
+		{
+			session->cancelDeadlines();
+
+			// Shutting down the connection. This method may
+			// fail in case socket is not connected. We don't care
+			// about the error code if this function fails.
+			boost::system::error_code ignored_ec;
+			session->shutdown(
+				boost::asio::ip::tcp::socket::shutdown_both,
+				ignored_ec
+			);
+			session->close();
+
+			// Remove session from the registry of active sessions.
+			m_active_sessions.erase(session->getID());
+
+			// Let the next waiting request in.
+			if (m_admission)
+				m_admission->release(session->getEndpoint());
+
+			boost::system::error_code actual_ec = ec;
+			if (session->isSessionTimedOut())
+				actual_ec = boost::asio::error::timed_out;
+			else if (cancelled)
+				actual_ec = boost::asio::error::operation_aborted;
+
+			// Call the callback provided by the user.
+			session->invokeCallback(actual_ec);
+		}
+	private:
+		inline static constexpr char m_op_name[] = "EMULATE_LONG_COMP_OP ";
+		ShardedRegistry<
+			std::size_t,
+			std::shared_ptr<BaseSession>,
+			64,
+			PoolAllocator<std::pair<const std::size_t, std::shared_ptr<BaseSession>>>
+		> m_active_sessions;
+		// Hedged requests which haven't completed yet.
+		ShardedRegistry<
+			std::size_t,
+			std::shared_ptr<HedgedRequestBase>,
+			64,
+			PoolAllocator<std::pair<const std::size_t, std::shared_ptr<HedgedRequestBase>>>
+		> m_hedged_requests;
+		IoContextPool m_io_pool;
+		std::unique_ptr<ConnectionPool> m_connection_pool;
+		std::unique_ptr<AdmissionControl> m_admission;
+		std::unique_ptr<HedgingControl> m_hedging;
+};
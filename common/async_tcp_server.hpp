@@ -0,0 +1,593 @@
+#pragma once
+
+// Asynchronous TCP server of the "emulate long computation" protocol.
+// Connections are served by a pool of I/O threads, either sharing the
+// single io_context or running an io_context per core, and long
+// computations run on the bounded compute pool or are modeled by
+// timers. Used by 04_impl_server_apps/tcp_asynchronous.cpp and
+// 06_other benchmarks.
+
+#include <boost/asio.hpp>
+
+#include "simd_read_until.hpp"
+#include "pool_allocator.hpp"
+#include "handler_allocator.hpp"
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <iostream>
+#include <charconv>
+#include <optional>
+#include <deque>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Bounded pool of threads for request processing.
+// Long computations are run here instead of I/O threads, so
+// a slow request doesn't stall other connections. The number
+// of pending computations is limited, when the pool is
+// saturated new requests are rejected right away.
+class ComputePool
+{
+	public:
+		ComputePool(std::size_t thread_count, std::size_t max_pending) :
+		m_pool(thread_count),
+		m_max_pending(max_pending)
+		{}
+
+		// Reserves a place for the computation. Returns false
+		// if there are too many pending computations.
+		bool tryReserve()
+		{
+			auto pending = m_pending.load();
+			do
+			{
+				if (pending == m_max_pending)
+					return false;
+			}
+			while (!m_pending.compare_exchange_weak(pending, pending + 1));
+
+			return true;
+		}
+
+		// Runs the computation reserved before with tryReserve().
+		template <class Job>
+		void execute(Job &&job)
+		{
+			boost::asio::post(
+				m_pool,
+				bindAllocator(
+					PoolAllocator<void>(),
+					[this, job=std::forward<Job>(job)]() mutable
+					{
+						job();
+						--m_pending;
+					}
+				)
+			);
+		}
+
+		void stop()
+		{
+			m_pool.stop();
+			m_pool.join();
+		}
+
+	private:
+		boost::asio::thread_pool m_pool;
+		std::atomic<std::size_t> m_pending{0};
+		const std::size_t m_max_pending;
+};
+
+// Responses and tags take memory from the pool, so a request
+// handled in steady state doesn't allocate from the heap.
+using PooledString =
+	std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+
+// Connection with a client. Client may send many requests over the
+// connection without waiting for responses. Request may be tagged
+// by appending " #<tag>" to it, the response to such request carries
+// the same tag, so the client is able to match responses computed
+// out of order to the requests.
+class Service : public std::enable_shared_from_this<Service>
+{
+	private:
+		// Constructor has to be public for std::allocate_shared,
+		// the tag keeps it from being called by anyone else.
+		struct ConstructorTag
+		{
+			explicit ConstructorTag() = default;
+		};
+
+	public:
+		// If compute_pool is null, long computation is modeled
+		// by the timer and doesn't occupy any thread.
+		void static startHandling(
+			boost::asio::ip::tcp::socket &&sock,
+			ComputePool *compute_pool
+		)
+		{
+			// Service and the shared_ptr control block share
+			// the single block taken from the pool.
+			auto service = std::allocate_shared<Service>(
+				PoolAllocator<Service>(),
+				ConstructorTag(),
+				std::move(sock),
+				compute_pool
+			);
+			service->readRequest();
+		}
+	private:
+		struct Request
+		{
+			// Duration of the requested computation or
+			// nothing if the request is invalid.
+			std::optional<std::chrono::seconds> duration;
+			PooledString tag;
+		};
+
+		void readRequest()
+		{
+			simd::async_read_until(
+				m_sock,
+				m_request,
+				'\n',
+				boost::asio::bind_executor(
+					m_strand,
+					bindAllocator(
+						HandlerAllocator<void>(m_read_memory),
+						[svc=shared_from_this()](auto &&ec, auto &&bt)
+						{
+							svc->onRequestReceived(
+								std::forward<decltype(ec)>(ec),
+								std::forward<decltype(bt)>(bt)
+							);
+						}
+					)
+				)
+			);
+		}
+
+		void onRequestReceived(
+			const boost::system::error_code &ec,
+			std::size_t bytes_transferred
+		)
+		{
+			if (!ec)
+			{
+				// Parse the request line without the delimiter.
+				auto request = parseRequest(
+					std::string_view(
+						static_cast<const char*>(m_request.data().data()),
+						bytes_transferred - 1
+					)
+				);
+				m_request.consume(bytes_transferred);
+
+				// Start reading of the next request, it is
+				// handled while this one is being computed.
+				readRequest();
+
+				processRequest(std::move(request));
+				return;
+			}
+
+			if (ec == boost::asio::error::eof)
+			{
+				// Client has closed the connection.
+				return;
+			}
+
+			std::cerr << "Error occured! Error code = "
+			<< ec
+			<< '\n';
+		}
+
+		void processRequest(Request request)
+		{
+			if (!request.duration)
+			{
+				sendResponse("ERROR", request.tag);
+				return;
+			}
+
+			if (request.duration->count() == 0)
+			{
+				// Nothing to compute.
+				sendResponse("OK", request.tag);
+				return;
+			}
+
+			if (!m_compute_pool)
+			{
+				// Emulate long computation without blocking
+				// any thread.
+				auto timer = std::allocate_shared<boost::asio::steady_timer>(
+					PoolAllocator<boost::asio::steady_timer>(),
+					m_strand.context(),
+					*request.duration
+				);
+				timer->async_wait(
+					boost::asio::bind_executor(
+						m_strand,
+						bindAllocator(
+							PoolAllocator<void>(),
+							[svc=shared_from_this(), timer, tag=std::move(request.tag)](
+								auto &&ec
+							)
+							{
+								svc->sendResponse(ec ? "ERROR" : "OK", tag);
+							}
+						)
+					)
+				);
+				return;
+			}
+
+			if (!m_compute_pool->tryReserve())
+			{
+				// Server is overloaded.
+				sendResponse("ERROR", request.tag);
+				return;
+			}
+
+			m_compute_pool->execute(
+				[svc=shared_from_this(), request=std::move(request)]() mutable
+				{
+					// Emulate request processing.
+					std::this_thread::sleep_for(*request.duration);
+
+					// Get back to the connection's strand.
+					auto &&strand = svc->m_strand;
+					boost::asio::post(
+						strand,
+						bindAllocator(
+							PoolAllocator<void>(),
+							[svc=std::move(svc), tag=std::move(request.tag)]
+							{
+								svc->sendResponse("OK", tag);
+							}
+						)
+					);
+				}
+			);
+		}
+
+		// Queues the response. Responses are written one by one
+		// in the order their computations have completed.
+		void sendResponse(std::string_view status, std::string_view tag)
+		{
+			auto &&response = m_write_queue.emplace_back(status);
+			if (!tag.empty())
+			{
+				response.append(" #");
+				response.append(tag);
+			}
+			response.push_back('\n');
+
+			if (m_write_queue.size() == 1)
+				writeResponse();
+		}
+
+		void writeResponse()
+		{
+			// Initiate asynchronous write operation.
+			boost::asio::async_write(
+				m_sock,
+				boost::asio::buffer(m_write_queue.front()),
+				boost::asio::bind_executor(
+					m_strand,
+					bindAllocator(
+						HandlerAllocator<void>(m_write_memory),
+						[svc=shared_from_this()](auto &&ec, auto &&bt)
+						{
+							svc->onResponseSent(
+								std::forward<decltype(ec)>(ec),
+								std::forward<decltype(bt)>(bt)
+							);
+						}
+					)
+				)
+			);
+		}
+
+		void onResponseSent(
+			const boost::system::error_code &ec,
+			std::size_t bytes_transferred
+		)
+		{
+			if (ec)
+			{
+				std::cerr << "Error occured! Error code = "
+				<< ec
+				<< '\n';
+				return;
+			}
+
+			m_write_queue.pop_front();
+			if (!m_write_queue.empty())
+				writeResponse();
+		}
+
+		Request static parseRequest(std::string_view request)
+		{
+			Request result;
+			if (auto tag_pos = request.rfind(" #"); tag_pos != std::string_view::npos)
+			{
+				result.tag = request.substr(tag_pos + 2);
+				request = request.substr(0, tag_pos);
+			}
+
+			std::string_view op = "EMULATE_LONG_COMP_OP ";
+			auto pos = request.find(op);
+			if (pos == std::string_view::npos)
+				return result;
+
+			int sec_count = 0;
+			auto sec_str_v = request.substr(pos + op.length()); 
+			if (
+					auto [ptr, ec] = std::from_chars(
+						sec_str_v.data(), 
+						sec_str_v.data()+sec_str_v.length(), 
+						sec_count
+					);
+					std::make_error_code(ec)
+			   )
+				return result;
+
+			result.duration = std::chrono::seconds(sec_count);
+			return result;
+		}
+	public:
+		Service(
+			ConstructorTag,
+			boost::asio::ip::tcp::socket &&sock,
+			ComputePool *compute_pool
+		) :
+		m_sock(std::move(sock)),
+		m_strand(
+			static_cast<boost::asio::io_context&>(m_sock.get_executor().context())
+		),
+		m_compute_pool(compute_pool)
+		{}
+	private:
+		boost::asio::ip::tcp::socket m_sock;
+		// Serializes handlers of the connection. Strand of io_context
+		// takes its implementation from the fixed set owned by the
+		// strand service, unlike strand<> it isn't allocated for every
+		// connection. Dispatching through the type-erased executor of
+		// the socket would allocate memory too.
+		boost::asio::io_context::strand m_strand;
+		ComputePool *m_compute_pool;
+		std::deque<PooledString, PoolAllocator<PooledString>> m_write_queue;
+		boost::asio::basic_streambuf<PoolAllocator<char>> m_request;
+
+		// Requests are read one after another and so are responses
+		// written, so each of them needs a single operation state.
+		HandlerMemory m_read_memory;
+		HandlerMemory m_write_memory;
+};
+
+#ifdef SO_REUSEPORT
+// Lets several sockets listen on the same port, the kernel
+// distributes incoming connections between them.
+using reuse_port =
+	boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+class Acceptor
+{
+	public:
+		Acceptor(
+			boost::asio::io_context &ioc,
+			std::uint16_t port_num,
+			ComputePool *compute_pool,
+			bool share_port = false
+		) :
+		m_ioc(ioc),
+		m_compute_pool(compute_pool),
+		m_acceptor(m_ioc)
+		{
+			boost::asio::ip::tcp::endpoint ep(
+				boost::asio::ip::address_v4::any(),
+				port_num
+			);
+			m_acceptor.open(ep.protocol());
+			m_acceptor.set_option(
+				boost::asio::ip::tcp::acceptor::reuse_address(true)
+			);
+#ifdef SO_REUSEPORT
+			if (share_port)
+				m_acceptor.set_option(reuse_port(true));
+#endif
+			m_acceptor.bind(ep);
+		}
+
+		// Start accepting incoming connection requests.
+		void start()
+		{
+			m_acceptor.listen();
+			initAccept();
+		}
+
+		// Stop accepting incoming connection requests.
+		void stop()
+		{
+			m_isStopped = true;
+		}
+	private:
+		void initAccept()
+		{
+			// Accepted socket is handed to the handler, it is moved
+			// into Service, so nothing is allocated per connection.
+			m_acceptor.async_accept(
+				bindAllocator(
+					HandlerAllocator<void>(m_accept_memory),
+					[this](auto &&ec, boost::asio::ip::tcp::socket sock)
+					{
+						onAccept(std::forward<decltype(ec)>(ec), std::move(sock));
+					}
+				)
+			);
+		}
+
+		void onAccept(
+			const boost::system::error_code &ec,
+			boost::asio::ip::tcp::socket &&sock
+		)
+		{
+			if (!ec)
+			{
+				Service::startHandling(std::move(sock), m_compute_pool);
+
+				// Init next async accept operation if
+				// acceptor has not been stopped yet.
+				if (!m_isStopped)
+				{
+					initAccept();
+					return;
+				}
+				// Stop accepting incoming connections
+				// and free allocated resources.
+				m_acceptor.close();
+				return;
+			}
+			
+			std::cerr << "Error occured! Error code = "
+			<< ec
+			<< '\n';
+		}
+	private:
+		boost::asio::io_context &m_ioc;
+		ComputePool *m_compute_pool;
+		boost::asio::ip::tcp::acceptor m_acceptor;
+		std::atomic<bool> m_isStopped{false};
+		// Accept operations are started one after another.
+		HandlerMemory m_accept_memory;
+};
+
+class Server
+{
+	public:
+		enum class Mode
+		{
+			// All threads run the single io_context
+			// with the single acceptor.
+			shared_io_context,
+			// Every thread runs its own io_context, is pinned to
+			// its own CPU and accepts connections on its own
+			// SO_REUSEPORT socket. Connections are balanced by
+			// the kernel and never migrate between threads.
+			io_context_per_core
+		};
+
+		// Start the server.
+		// If compute_pool_size is 0, long computations are
+		// modeled by timers instead of the compute pool.
+		void start(
+			std::uint16_t port_num,
+			std::size_t thread_pool_size,
+			Mode mode = Mode::shared_io_context,
+			std::size_t compute_pool_size = 0
+		)
+		{
+			assert(0 < thread_pool_size);
+
+			if (compute_pool_size)
+				m_compute_pool = std::make_unique<ComputePool>(
+					compute_pool_size,
+					MAX_PENDING_COMPUTATIONS
+				);
+
+#ifndef SO_REUSEPORT
+			// Acceptors can't share the port.
+			mode = Mode::shared_io_context;
+#endif
+			bool per_core = mode == Mode::io_context_per_core;
+			std::size_t contexts_count = per_core ? thread_pool_size : 1;
+			bool share_port = 1 < contexts_count;
+
+			for (std::size_t i = 0; i != contexts_count; ++i)
+			{
+				// io_context run by a single thread
+				// doesn't need internal locking.
+				auto &&ioc = *m_contexts.emplace_back(
+					std::make_unique<boost::asio::io_context>(
+						per_core ? 1 : BOOST_ASIO_CONCURRENCY_HINT_DEFAULT
+					)
+				);
+				m_work.emplace_back(boost::asio::make_work_guard(ioc));
+
+				// Create and start Acceptor.
+				auto &&acc = m_acceptors.emplace_back(
+					std::make_unique<Acceptor>(
+						ioc,
+						port_num,
+						m_compute_pool.get(),
+						share_port
+					)
+				);
+				acc->start();
+			}
+
+			// Create specified number of threads and
+			// add them to the pool.
+			for (std::size_t i = 0; i != thread_pool_size; ++i)
+			{
+				auto &&ioc = *m_contexts[i % contexts_count];
+				auto &&th = m_thread_pool.emplace_back([&ioc]{ioc.run();});
+				if (per_core)
+					pin_thread(th, i);
+			}
+		}
+
+		// Stop the server.
+		void stop()
+		{
+			for (auto &&acc : m_acceptors)
+				acc->stop();
+			for (auto &&ioc : m_contexts)
+				ioc->stop();
+
+			for (auto &&th : m_thread_pool)
+				if (th.joinable()) th.join();
+
+			if (m_compute_pool)
+				m_compute_pool->stop();
+		}
+	private:
+		void static pin_thread(std::thread &th, std::size_t cpu)
+		{
+#ifdef __linux__
+			auto cpu_count = std::thread::hardware_concurrency();
+			if (!cpu_count)
+				return;
+
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu % cpu_count, &cpu_set);
+			// Failure to pin the thread is not fatal,
+			// the thread just may be migrated.
+			pthread_setaffinity_np(
+				th.native_handle(),
+				sizeof(cpu_set),
+				&cpu_set
+			);
+#endif
+		}
+	private:
+		using work_guard = 
+			boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+		std::vector<std::unique_ptr<boost::asio::io_context>> m_contexts;
+		std::vector<work_guard> m_work;
+		std::vector<std::unique_ptr<Acceptor>> m_acceptors;
+		std::vector<std::thread> m_thread_pool;
+		std::unique_ptr<ComputePool> m_compute_pool;
+
+		constexpr inline std::size_t static MAX_PENDING_COMPUTATIONS = 1024;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+// Custom memory allocation for completion handlers, see the
+// "allocation" example of Boost.Asio. Asio allocates the state of
+// every asynchronous operation through the allocator associated with
+// its completion handler. Objects which start their operations one
+// after another keep HandlerMemory for them, so the operation state
+// is placed into the object itself. Handlers bound with
+// bindAllocator() carry the allocator through Asio.
+
+#include <boost/asio.hpp>
+
+#include "pool_allocator.hpp"
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Storage for the state of the single outstanding operation. If it's
+// occupied by another operation, memory is taken from MemoryPool.
+class HandlerMemory
+{
+	public:
+		HandlerMemory() = default;
+		HandlerMemory(const HandlerMemory&) = delete;
+		HandlerMemory &operator=(const HandlerMemory&) = delete;
+
+		void *allocate(std::size_t size)
+		{
+			if (!m_in_use && size <= sizeof(m_storage))
+			{
+				m_in_use = true;
+				return &m_storage;
+			}
+
+			return MemoryPool::allocate(size);
+		}
+
+		void deallocate(void *p, std::size_t size) noexcept
+		{
+			if (p == &m_storage)
+			{
+				m_in_use = false;
+				return;
+			}
+
+			MemoryPool::deallocate(p, size);
+		}
+
+	private:
+		std::aligned_storage_t<512> m_storage;
+		bool m_in_use = false;
+};
+
+template <class T>
+class HandlerAllocator
+{
+	public:
+		using value_type = T;
+
+		explicit HandlerAllocator(HandlerMemory &memory) noexcept :
+		m_memory(&memory)
+		{}
+
+		template <class U>
+		HandlerAllocator(const HandlerAllocator<U> &other) noexcept :
+		m_memory(other.m_memory)
+		{}
+
+		T *allocate(std::size_t n)
+		{
+			return static_cast<T*>(m_memory->allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, std::size_t n) noexcept
+		{
+			m_memory->deallocate(p, n * sizeof(T));
+		}
+
+		template <class U>
+		bool operator==(const HandlerAllocator<U> &other) const noexcept
+		{
+			return m_memory == other.m_memory;
+		}
+
+		template <class U>
+		bool operator!=(const HandlerAllocator<U> &other) const noexcept
+		{
+			return m_memory != other.m_memory;
+		}
+
+	private:
+		template <class> friend class HandlerAllocator;
+
+		HandlerMemory *m_memory;
+};
+
+// Completion handler with the associated allocator.
+template <class Handler, class Allocator>
+class AllocatorBinder
+{
+	public:
+		using allocator_type = Allocator;
+
+		AllocatorBinder(const Allocator &allocator, Handler handler) :
+		m_allocator(allocator),
+		m_handler(std::move(handler))
+		{}
+
+		allocator_type get_allocator() const noexcept
+		{
+			return m_allocator;
+		}
+
+		template <class ...Args>
+		void operator()(Args &&...args)
+		{
+			m_handler(std::forward<Args>(args)...);
+		}
+
+	private:
+		Allocator m_allocator;
+		Handler m_handler;
+};
+
+template <class Allocator, class Handler>
+auto bindAllocator(const Allocator &allocator, Handler &&handler)
+{
+	return AllocatorBinder<std::decay_t<Handler>, Allocator>(
+		allocator,
+		std::forward<Handler>(handler)
+	);
+}
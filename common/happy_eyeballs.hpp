@@ -0,0 +1,309 @@
+#pragma once
+
+// Connection racing of Happy Eyeballs (RFC 8305). Endpoints are
+// ordered so that address families alternate, starting with the
+// family of the first endpoint. Attempts are started one after another
+// with the attempt delay between them, the next one starts at once
+// when the previous one fails. The first socket which connects is
+// used, the rest are closed. Unreachable address costs the attempt
+// delay instead of the whole connect timeout.
+// The connector is owned by the user, it must outlive the operation.
+// Its executor must be run by a single thread, cancel() may be called
+// from any thread.
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template <class Protocol>
+class HappyEyeballsConnector
+{
+	public:
+		using clock = std::chrono::steady_clock;
+		using socket_type = typename Protocol::socket;
+		using endpoint_type = typename Protocol::endpoint;
+		using Handler = std::function<
+			void (const boost::system::error_code&, const endpoint_type&)
+		>;
+
+		// Connection Attempt Delay recommended by RFC 8305.
+		constexpr inline static std::chrono::milliseconds DEFAULT_ATTEMPT_DELAY{250};
+
+		explicit HappyEyeballsConnector(
+			const boost::asio::any_io_executor &executor,
+			clock::duration attempt_delay = DEFAULT_ATTEMPT_DELAY
+		) :
+		m_executor(executor),
+		m_timer(executor),
+		m_attempt_delay(attempt_delay)
+		{}
+
+		HappyEyeballsConnector(const HappyEyeballsConnector&) = delete;
+		HappyEyeballsConnector &operator=(const HappyEyeballsConnector&) = delete;
+
+		// Connects the socket to one of the endpoints, handler(ec, ep)
+		// is called with the endpoint connected to. The socket must
+		// use the executor of the connector.
+		void asyncConnect(
+			socket_type &socket,
+			std::vector<endpoint_type> endpoints,
+			Handler handler
+		)
+		{
+			std::lock_guard lock(m_guard);
+			m_socket = &socket;
+			m_handler = std::move(handler);
+			m_endpoints = interleave(std::move(endpoints));
+			m_attempts.clear();
+			m_attempts.reserve(m_endpoints.size());
+			m_next = 0;
+			m_failed = 0;
+			m_winner = NO_WINNER;
+			m_error = boost::system::error_code();
+			m_is_running = true;
+			m_is_done = false;
+
+			if (m_endpoints.empty())
+			{
+				m_error = boost::asio::error::not_found;
+				m_is_done = true;
+				++m_pending;
+				boost::asio::post(
+					m_executor,
+					[this]
+					{
+						std::unique_lock lock(m_guard);
+						--m_pending;
+						finishIfDone(lock);
+					}
+				);
+				return;
+			}
+
+			startAttempt();
+		}
+
+		// Aborts the operation, the handler is called with
+		// operation_aborted unless a socket has already connected.
+		void cancel()
+		{
+			std::lock_guard lock(m_guard);
+			if (!m_is_running || m_is_done)
+				return;
+
+			m_is_done = true;
+			m_error = boost::asio::error::operation_aborted;
+			boost::system::error_code ignored_ec;
+			for (auto &&attempt : m_attempts)
+				attempt.cancel(ignored_ec);
+			m_timer.cancel();
+		}
+
+		// Synchronous form. Attempts run on the io_context of their
+		// own, the connected socket is handed over to the socket.
+		static endpoint_type connect(
+			socket_type &socket,
+			const std::vector<endpoint_type> &endpoints,
+			boost::system::error_code &ec,
+			clock::duration attempt_delay = DEFAULT_ATTEMPT_DELAY
+		)
+		{
+			boost::asio::io_context ioc;
+			socket_type connected(ioc);
+			HappyEyeballsConnector connector(ioc.get_executor(), attempt_delay);
+
+			endpoint_type ep;
+			connector.asyncConnect(
+				connected,
+				endpoints,
+				[&ec, &ep](const boost::system::error_code &result, const endpoint_type &result_ep)
+				{
+					ec = result;
+					ep = result_ep;
+				}
+			);
+			ioc.run();
+
+			if (!ec)
+			{
+				boost::system::error_code ignored_ec;
+				socket.close(ignored_ec);
+				socket.assign(ep.protocol(), connected.release(), ec);
+			}
+			return ep;
+		}
+
+		// Throws boost::system::system_error if no endpoint is connected to.
+		static endpoint_type connect(
+			socket_type &socket,
+			const std::vector<endpoint_type> &endpoints,
+			clock::duration attempt_delay = DEFAULT_ATTEMPT_DELAY
+		)
+		{
+			boost::system::error_code ec;
+			auto ep = connect(socket, endpoints, ec, attempt_delay);
+			if (ec)
+				throw boost::system::system_error(ec);
+			return ep;
+		}
+
+	private:
+		constexpr inline static std::size_t NO_WINNER =
+			std::numeric_limits<std::size_t>::max();
+
+		static std::vector<endpoint_type> interleave(std::vector<endpoint_type> endpoints)
+		{
+			if (endpoints.empty())
+				return endpoints;
+
+			// Order within the families is kept.
+			auto is_first_v6 = endpoints.front().address().is_v6();
+			auto middle = std::stable_partition(
+				endpoints.begin(),
+				endpoints.end(),
+				[is_first_v6](const endpoint_type &ep)
+				{
+					return ep.address().is_v6() == is_first_v6;
+				}
+			);
+
+			std::vector<endpoint_type> ordered;
+			ordered.reserve(endpoints.size());
+			for (auto first = endpoints.begin(), second = middle;
+				first != middle || second != endpoints.end();)
+			{
+				if (first != middle)
+					ordered.push_back(*first++);
+				if (second != endpoints.end())
+					ordered.push_back(*second++);
+			}
+			return ordered;
+		}
+
+		// Called with m_guard locked.
+		void startAttempt()
+		{
+			auto index = m_next++;
+			auto &&attempt = m_attempts.emplace_back(m_executor);
+			++m_pending;
+			attempt.async_connect(
+				m_endpoints[index],
+				[this, index](const boost::system::error_code &ec)
+				{
+					onAttemptComplete(index, ec);
+				}
+			);
+
+			// Delay which has been started for the previous attempt
+			// is stale, its completion is told apart by the generation.
+			++m_generation;
+			if (m_next == m_endpoints.size())
+			{
+				m_timer.cancel();
+				return;
+			}
+
+			++m_pending;
+			m_timer.expires_after(m_attempt_delay);
+			m_timer.async_wait(
+				[this, generation = m_generation](const boost::system::error_code &ec)
+				{
+					onDelayElapsed(generation, ec);
+				}
+			);
+		}
+
+		void onDelayElapsed(std::size_t generation, const boost::system::error_code &ec)
+		{
+			std::unique_lock lock(m_guard);
+			--m_pending;
+			if (!ec && !m_is_done && generation == m_generation)
+				startAttempt();
+			finishIfDone(lock);
+		}
+
+		void onAttemptComplete(std::size_t index, const boost::system::error_code &ec)
+		{
+			std::unique_lock lock(m_guard);
+			--m_pending;
+			if (!m_is_done)
+			{
+				if (!ec)
+				{
+					m_is_done = true;
+					m_winner = index;
+					m_error = ec;
+					boost::system::error_code ignored_ec;
+					for (auto &&attempt : m_attempts)
+						if (&attempt != &m_attempts[index])
+							attempt.cancel(ignored_ec);
+					m_timer.cancel();
+				}
+				else
+				{
+					m_error = ec;
+					if (++m_failed == m_endpoints.size())
+						m_is_done = true;
+					else if (m_next != m_endpoints.size())
+						startAttempt();
+				}
+			}
+			finishIfDone(lock);
+		}
+
+		// Handler is called once the handlers of all attempts and of
+		// the timer have returned, so nothing refers to the connector.
+		void finishIfDone(std::unique_lock<std::mutex> &lock)
+		{
+			if (!m_is_done || m_pending)
+				return;
+
+			endpoint_type ep;
+			boost::system::error_code ignored_ec;
+			for (std::size_t i = 0; i != m_attempts.size(); ++i)
+			{
+				if (i == m_winner)
+				{
+					ep = m_endpoints[i];
+					*m_socket = std::move(m_attempts[i]);
+				}
+				else
+				{
+					m_attempts[i].close(ignored_ec);
+				}
+			}
+			m_attempts.clear();
+			m_is_running = false;
+
+			auto handler = std::move(m_handler);
+			auto ec = m_error;
+			lock.unlock();
+			handler(ec, ep);
+		}
+
+	private:
+		boost::asio::any_io_executor m_executor;
+		boost::asio::steady_timer m_timer;
+		clock::duration m_attempt_delay;
+
+		std::mutex m_guard;
+		socket_type *m_socket = nullptr;
+		Handler m_handler;
+		std::vector<endpoint_type> m_endpoints;
+		std::vector<socket_type> m_attempts;
+		std::size_t m_next = 0;       // Endpoint to be tried next.
+		std::size_t m_failed = 0;
+		std::size_t m_winner = NO_WINNER;
+		std::size_t m_pending = 0;    // Outstanding handlers.
+		std::size_t m_generation = 0; // Of the attempt delay.
+		boost::system::error_code m_error;
+		bool m_is_running = false;
+		bool m_is_done = false;
+};
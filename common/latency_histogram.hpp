@@ -0,0 +1,119 @@
+#pragma once
+
+// Histogram of latencies used to estimate their percentiles.
+// Every power of two of microseconds is split into 8 buckets, so
+// the estimate is within 12.5% of the real value. Counters are
+// atomic, recording takes no locks. Old samples are aged out: once
+// twice the window has been recorded all counters are halved, so
+// the histogram follows the recent latencies.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class LatencyHistogram
+{
+	public:
+		using clock = std::chrono::steady_clock;
+
+		explicit LatencyHistogram(std::uint64_t window = 4096) :
+		m_window(window)
+		{}
+
+		LatencyHistogram(const LatencyHistogram&) = delete;
+		LatencyHistogram &operator=(const LatencyHistogram&) = delete;
+
+		void record(clock::duration latency)
+		{
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+			m_buckets[getBucketIndex(us < 0 ? 0 : static_cast<std::uint64_t>(us))]
+				.fetch_add(1, std::memory_order_relaxed);
+
+			// Counters are halved by the thread which records the
+			// sample completing the second window. Samples recorded
+			// concurrently may be lost, which is fine for the estimate.
+			if (m_count.fetch_add(1, std::memory_order_relaxed) + 1 == 2 * m_window)
+			{
+				for (auto &&bucket : m_buckets)
+					bucket.store(
+						bucket.load(std::memory_order_relaxed) / 2,
+						std::memory_order_relaxed
+					);
+				m_count.fetch_sub(m_window, std::memory_order_relaxed);
+			}
+		}
+
+		// Number of samples the estimate is based on.
+		std::uint64_t getCount() const
+		{
+			return m_count.load(std::memory_order_relaxed);
+		}
+
+		// Upper bound of the bucket containing the percentile,
+		// p is in (0, 1]. Returns zero if there are no samples.
+		clock::duration getPercentile(double p) const
+		{
+			std::array<std::uint64_t, BUCKET_COUNT> counts;
+			std::uint64_t total = 0;
+			for (std::size_t i = 0; i != BUCKET_COUNT; ++i)
+				total += counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+			if (!total)
+				return clock::duration::zero();
+
+			auto rank = static_cast<std::uint64_t>(p * static_cast<double>(total));
+			if (rank == 0)
+				rank = 1;
+
+			std::uint64_t seen = 0;
+			std::size_t i = 0;
+			for (; i != BUCKET_COUNT - 1; ++i)
+			{
+				seen += counts[i];
+				if (rank <= seen)
+					break;
+			}
+
+			return std::chrono::duration_cast<clock::duration>(
+				std::chrono::microseconds(getBucketUpperBound(i))
+			);
+		}
+
+	private:
+		constexpr inline static std::size_t SUB_BUCKET_BITS = 3;
+		constexpr inline static std::size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+		// Values below SUB_BUCKETS have a bucket each, then every
+		// power of two up to 2^63 has SUB_BUCKETS of them.
+		constexpr inline static std::size_t BUCKET_COUNT =
+			(64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+		static std::size_t getBucketIndex(std::uint64_t us)
+		{
+			if (us < SUB_BUCKETS)
+				return static_cast<std::size_t>(us);
+
+			std::size_t msb = 63;
+			while (!(us >> msb))
+				--msb;
+
+			auto shift = msb - SUB_BUCKET_BITS;
+			auto sub_bucket = static_cast<std::size_t>(us >> shift) - SUB_BUCKETS;
+			return (shift + 1) * SUB_BUCKETS + sub_bucket;
+		}
+
+		static std::uint64_t getBucketUpperBound(std::size_t index)
+		{
+			if (index < SUB_BUCKETS)
+				return index + 1;
+
+			auto shift = index / SUB_BUCKETS - 1;
+			auto sub_bucket = index % SUB_BUCKETS;
+			return std::uint64_t(SUB_BUCKETS + sub_bucket + 1) << shift;
+		}
+
+	private:
+		const std::uint64_t m_window;
+		std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> m_buckets{};
+		std::atomic<std::uint64_t> m_count{0};
+};
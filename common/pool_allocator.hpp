@@ -0,0 +1,203 @@
+#pragma once
+
+// Allocator which recycles memory blocks instead of returning them
+// to the heap. Blocks are grouped in size classes of powers of two
+// from 16 bytes to 4 KiB, larger requests go to operator new.
+// Every thread keeps free lists of its own, so allocation and
+// deallocation take no locks. Objects are often created on one thread
+// and destroyed on another (request is submitted by the user thread
+// and completed on the I/O thread), so a thread which has collected
+// too many free blocks hands a batch of them over to the shared depot
+// and a thread which has run out of blocks takes a batch from there.
+// In steady state memory of destroyed objects is reused for new ones
+// and the heap isn't touched.
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <utility>
+
+class MemoryPool
+{
+	public:
+		static void *allocate(std::size_t size)
+		{
+			auto index = sizeClass(size);
+			if (index == CLASS_COUNT || t_cache_destroyed)
+				return ::operator new(blockSize(index, size));
+
+			auto &&list = cache().lists[index];
+			if (!list.head)
+				depot().takeBatch(index, list);
+			if (!list.head)
+				return ::operator new(blockSize(index, size));
+
+			auto block = list.head;
+			list.head = block->next;
+			--list.count;
+			return block;
+		}
+
+		static void deallocate(void *p, std::size_t size) noexcept
+		{
+			auto index = sizeClass(size);
+			if (index == CLASS_COUNT || t_cache_destroyed)
+			{
+				::operator delete(p);
+				return;
+			}
+
+			auto &&list = cache().lists[index];
+			auto block = static_cast<Block*>(p);
+			block->next = list.head;
+			list.head = block;
+
+			if (++list.count == 2 * BATCH_SIZE)
+				depot().putBatch(index, list);
+		}
+
+	private:
+		struct Block
+		{
+			Block *next;
+			Block *next_batch; // Used by the depot only.
+		};
+
+		constexpr inline static std::size_t MIN_BLOCK_SIZE = sizeof(Block);
+		constexpr inline static std::size_t CLASS_COUNT = 9; // Up to 4 KiB.
+		constexpr inline static std::size_t BATCH_SIZE = 32;
+
+		struct FreeList
+		{
+			Block *head = nullptr;
+			std::size_t count = 0;
+		};
+
+		struct Cache
+		{
+			std::array<FreeList, CLASS_COUNT> lists;
+
+			~Cache()
+			{
+				for (auto &&list : lists)
+				{
+					while (list.head)
+						::operator delete(std::exchange(list.head, list.head->next));
+				}
+				t_cache_destroyed = true;
+			}
+		};
+
+		// Free blocks shared by all threads. Blocks are moved in
+		// batches, so the lock is taken once per BATCH_SIZE
+		// allocations at most.
+		class Depot
+		{
+			public:
+				void takeBatch(std::size_t index, FreeList &list)
+				{
+					std::lock_guard lock(m_guard);
+					auto &&batches = m_batches[index];
+					if (!batches)
+						return;
+
+					list.head = batches;
+					list.count = BATCH_SIZE;
+					batches = batches->next_batch;
+				}
+
+				void putBatch(std::size_t index, FreeList &list)
+				{
+					auto batch = list.head;
+					auto last = batch;
+					for (std::size_t i = 1; i != BATCH_SIZE; ++i)
+						last = last->next;
+					list.head = last->next;
+					list.count -= BATCH_SIZE;
+					last->next = nullptr;
+
+					std::lock_guard lock(m_guard);
+					auto &&batches = m_batches[index];
+					batch->next_batch = batches;
+					batches = batch;
+				}
+
+			private:
+				std::mutex m_guard;
+				std::array<Block*, CLASS_COUNT> m_batches{};
+		};
+
+		static std::size_t sizeClass(std::size_t size)
+		{
+			std::size_t index = 0;
+			while (index != CLASS_COUNT && (MIN_BLOCK_SIZE << index) < size)
+				++index;
+			return index;
+		}
+
+		static std::size_t blockSize(std::size_t index, std::size_t size)
+		{
+			return index == CLASS_COUNT ? size : MIN_BLOCK_SIZE << index;
+		}
+
+		static Cache &cache()
+		{
+			thread_local Cache cache;
+			return cache;
+		}
+
+		static Depot &depot()
+		{
+			// Depot is never destroyed, blocks may be freed by
+			// objects with static storage duration at exit.
+			static Depot &depot = *new Depot;
+			return depot;
+		}
+
+	private:
+		// Blocks freed by thread_local objects destroyed after
+		// the cache go straight to the heap.
+		inline static thread_local bool t_cache_destroyed = false;
+};
+
+// Standard allocator over MemoryPool. All instances are
+// interchangeable, memory allocated by one may be freed by another.
+template <class T>
+class PoolAllocator
+{
+	public:
+		using value_type = T;
+
+		PoolAllocator() noexcept = default;
+
+		template <class U>
+		PoolAllocator(const PoolAllocator<U>&) noexcept
+		{}
+
+		T *allocate(std::size_t n)
+		{
+			static_assert(
+				alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+				"over-aligned types are not supported"
+			);
+			return static_cast<T*>(MemoryPool::allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T *p, std::size_t n) noexcept
+		{
+			MemoryPool::deallocate(p, n * sizeof(T));
+		}
+
+		template <class U>
+		bool operator==(const PoolAllocator<U>&) const noexcept
+		{
+			return true;
+		}
+
+		template <class U>
+		bool operator!=(const PoolAllocator<U>&) const noexcept
+		{
+			return false;
+		}
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+// Process-wide cache of host name resolutions shared by the clients.
+// Every host is looked up once however many requests need it at the
+// same time: lookups of the host which is being resolved wait for the
+// query in flight. Resolved addresses are kept for the time to live,
+// failures are kept for the shorter negative time to live, so the
+// host which doesn't exist isn't queried for every request. Entry
+// used shortly before its expiry is refreshed in the background, the
+// hot host keeps being served from the cache meanwhile.
+// getaddrinfo() doesn't report TTLs of DNS records, so they are set
+// by the Policy. Queries run on the thread owned by the cache.
+// Expired entries are removed once the cache has grown twice since
+// the last sweep, so hosts looked up only once don't pile up.
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ResolverCache
+{
+	public:
+		using clock = std::chrono::steady_clock;
+		using Addresses = std::vector<boost::asio::ip::address>;
+
+		struct Policy
+		{
+			clock::duration ttl = std::chrono::seconds(60);
+			clock::duration negative_ttl = std::chrono::seconds(5);
+			// Entry used within this time before its expiry
+			// is refreshed in the background.
+			clock::duration refresh_ahead = std::chrono::seconds(10);
+		};
+
+		static ResolverCache &getInstance()
+		{
+			static ResolverCache cache;
+			return cache;
+		}
+
+		ResolverCache(const ResolverCache&) = delete;
+		ResolverCache &operator=(const ResolverCache&) = delete;
+
+		~ResolverCache()
+		{
+			m_work.reset();
+			m_ioc.stop();
+			m_thread.join();
+		}
+
+		// Applies to the entries resolved afterwards.
+		void setPolicy(const Policy &policy)
+		{
+			std::lock_guard lock(m_guard);
+			m_policy = policy;
+		}
+
+		// Calls handler(ec, addresses) on the calling thread if the
+		// host is cached, on the thread of the cache otherwise.
+		// Handler must be copyable.
+		template <class Handler>
+		void lookup(std::string_view host, Handler &&handler)
+		{
+			// Addresses aren't looked up.
+			boost::system::error_code ec;
+			auto address = boost::asio::ip::make_address(host, ec);
+			if (!ec)
+			{
+				handler(ec, Addresses{address});
+				return;
+			}
+
+			std::unique_lock lock(m_guard);
+			auto now = clock::now();
+			if (m_sweep_size <= m_entries.size())
+				removeExpired(now);
+			auto &&entry = m_entries[std::string(host)];
+			if (entry.is_pending)
+			{
+				entry.waiters.emplace_back(std::forward<Handler>(handler));
+				return;
+			}
+
+			if (now < entry.expiry)
+			{
+				bool is_refresh_due =
+					!entry.ec &&
+					!entry.is_refreshing &&
+					entry.refresh_at <= now;
+				if (is_refresh_due)
+					entry.is_refreshing = true;
+				auto entry_ec = entry.ec;
+				auto addresses = entry.addresses;
+				lock.unlock();
+
+				if (is_refresh_due)
+					startQuery(host);
+				handler(entry_ec, *addresses);
+				return;
+			}
+
+			entry.is_pending = true;
+			entry.waiters.emplace_back(std::forward<Handler>(handler));
+			// Entry has expired while it's being refreshed, lookups
+			// wait for the refresh instead of the query of their own.
+			if (entry.is_refreshing)
+				return;
+
+			lock.unlock();
+			startQuery(host);
+		}
+
+		// Resolves the host, handler(ec, endpoints) is posted to the
+		// executor. Handler must be copyable.
+		template <class Protocol, class Executor, class Handler>
+		void asyncResolve(
+			const Executor &executor,
+			std::string_view host,
+			std::uint16_t port,
+			Handler &&handler
+		)
+		{
+			lookup(
+				host,
+				[executor, port, handler = std::forward<Handler>(handler)](
+					const boost::system::error_code &ec,
+					const Addresses &addresses
+				)
+				{
+					boost::asio::post(
+						executor,
+						[handler, ec, endpoints = makeEndpoints<Protocol>(addresses, port)]() mutable
+						{
+							handler(ec, std::move(endpoints));
+						}
+					);
+				}
+			);
+		}
+
+		template <class Protocol>
+		std::vector<typename Protocol::endpoint> resolve(
+			std::string_view host,
+			std::uint16_t port,
+			boost::system::error_code &ec
+		)
+		{
+			std::promise<std::pair<boost::system::error_code, Addresses>> result;
+			lookup(
+				host,
+				[&result](const boost::system::error_code &ec, const Addresses &addresses)
+				{
+					result.set_value({ec, addresses});
+				}
+			);
+
+			auto [result_ec, addresses] = result.get_future().get();
+			ec = result_ec;
+			return makeEndpoints<Protocol>(addresses, port);
+		}
+
+		// Throws boost::system::system_error if the host can't be resolved.
+		template <class Protocol>
+		std::vector<typename Protocol::endpoint> resolve(
+			std::string_view host,
+			std::uint16_t port
+		)
+		{
+			boost::system::error_code ec;
+			auto endpoints = resolve<Protocol>(host, port, ec);
+			if (ec)
+				throw boost::system::system_error(ec);
+			return endpoints;
+		}
+
+	private:
+		using Waiter = std::function<
+			void (const boost::system::error_code&, const Addresses&)
+		>;
+
+		struct Entry
+		{
+			std::shared_ptr<const Addresses> addresses;
+			boost::system::error_code ec;
+			clock::time_point expiry;
+			clock::time_point refresh_at;
+			// Lookups wait for the query.
+			bool is_pending = false;
+			// Entry is served while it's being refreshed.
+			bool is_refreshing = false;
+			std::vector<Waiter> waiters;
+		};
+
+		// Cache isn't swept until it has this many entries.
+		constexpr inline static std::size_t MIN_SWEEP_SIZE = 1024;
+
+		ResolverCache() = default;
+
+		template <class Protocol>
+		static std::vector<typename Protocol::endpoint> makeEndpoints(
+			const Addresses &addresses,
+			std::uint16_t port
+		)
+		{
+			std::vector<typename Protocol::endpoint> endpoints;
+			endpoints.reserve(addresses.size());
+			for (auto &&address : addresses)
+				endpoints.emplace_back(address, port);
+			return endpoints;
+		}
+
+		// Called with m_guard locked. Entries which wait for the
+		// query are kept, its completion refers to them.
+		void removeExpired(clock::time_point now)
+		{
+			for (auto it = m_entries.begin(); it != m_entries.end();)
+			{
+				auto &&entry = it->second;
+				if (entry.expiry <= now && !entry.is_pending && !entry.is_refreshing)
+					it = m_entries.erase(it);
+				else
+					++it;
+			}
+			m_sweep_size = std::max(MIN_SWEEP_SIZE, 2 * m_entries.size());
+		}
+
+		void startQuery(std::string_view host)
+		{
+			auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(m_ioc);
+			resolver->async_resolve(
+				host,
+				"0",
+				boost::asio::ip::tcp::resolver::numeric_service,
+				[this, resolver, host = std::string(host)](
+					const boost::system::error_code &ec,
+					const boost::asio::ip::tcp::resolver::results_type &results
+				)
+				{
+					onQueryComplete(host, ec, results);
+				}
+			);
+		}
+
+		void onQueryComplete(
+			const std::string &host,
+			const boost::system::error_code &ec,
+			const boost::asio::ip::tcp::resolver::results_type &results
+		)
+		{
+			auto addresses = std::make_shared<Addresses>();
+			addresses->reserve(results.size());
+			for (auto &&result : results)
+				addresses->push_back(result.endpoint().address());
+
+			std::vector<Waiter> waiters;
+			{
+				std::lock_guard lock(m_guard);
+				auto &&entry = m_entries[host];
+
+				// Failed refresh doesn't replace the entry, it's
+				// served until its expiry. Once lookups wait for
+				// the refresh, they get its result, failure too.
+				if (ec && entry.is_refreshing && !entry.is_pending)
+				{
+					entry.is_refreshing = false;
+					return;
+				}
+
+				auto now = clock::now();
+				entry.addresses = addresses;
+				entry.ec = ec;
+				// Query aborted at shutdown isn't cached.
+				entry.expiry = ec == boost::asio::error::operation_aborted ? now :
+					now + (ec ? m_policy.negative_ttl : m_policy.ttl);
+				entry.refresh_at = entry.expiry - m_policy.refresh_ahead;
+				entry.is_pending = false;
+				entry.is_refreshing = false;
+				waiters.swap(entry.waiters);
+			}
+
+			for (auto &&waiter : waiters)
+				waiter(ec, *addresses);
+		}
+
+	private:
+		std::mutex m_guard;
+		Policy m_policy;
+		std::unordered_map<std::string, Entry> m_entries;
+		// Size of m_entries which triggers the next sweep.
+		std::size_t m_sweep_size = MIN_SWEEP_SIZE;
+
+		boost::asio::io_context m_ioc;
+		boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work =
+			boost::asio::make_work_guard(m_ioc);
+		std::thread m_thread{[this]{ m_ioc.run(); }};
+};
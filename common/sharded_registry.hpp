@@ -0,0 +1,121 @@
+#pragma once
+
+// Hash table split into independently locked shards.
+// Operations on different keys take different locks most of the
+// time, so threads inserting, looking up and erasing entries
+// concurrently don't contend on a single global mutex.
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+template <
+	class Key,
+	class Value,
+	std::size_t ShardCount = 64,
+	class Allocator = std::allocator<std::pair<const Key, Value>>
+>
+class ShardedRegistry
+{
+	public:
+		// Adds the value or replaces the one stored with the key.
+		void insert(const Key &key, Value value)
+		{
+			auto &&shard = getShard(key);
+			std::lock_guard lock(shard.guard);
+			shard.entries.insert_or_assign(key, std::move(value));
+		}
+
+		// Adds all key-value pairs of the range. Entries are grouped
+		// by shards first, so every shard is locked once however many
+		// entries go to it. Pass move iterators to move the values.
+		template <class ForwardIt>
+		void insert(ForwardIt first, ForwardIt last)
+		{
+			// Counting sort of the entries by their shards.
+			std::array<std::size_t, ShardCount + 1> bounds{};
+			for (auto it = first; it != last; ++it)
+				++bounds[getShardIndex(it->first) + 1];
+			for (std::size_t i = 0; i != ShardCount; ++i)
+				bounds[i + 1] += bounds[i];
+
+			std::vector<ForwardIt> sorted(bounds[ShardCount]);
+			auto positions = bounds;
+			for (auto it = first; it != last; ++it)
+				sorted[positions[getShardIndex(it->first)]++] = it;
+
+			for (std::size_t i = 0; i != ShardCount; ++i)
+			{
+				if (bounds[i] == bounds[i + 1])
+					continue;
+
+				auto &&shard = m_shards[i];
+				std::lock_guard lock(shard.guard);
+				for (auto k = bounds[i]; k != bounds[i + 1]; ++k)
+				{
+					auto &&entry = *sorted[k];
+					shard.entries.insert_or_assign(
+						entry.first,
+						std::forward<decltype(entry)>(entry).second
+					);
+				}
+			}
+		}
+
+		// Calls func with the value stored with the key while the
+		// shard is locked. Returns false if there is no such key.
+		template <class Func>
+		bool visit(const Key &key, Func &&func)
+		{
+			auto &&shard = getShard(key);
+			std::lock_guard lock(shard.guard);
+
+			auto it = shard.entries.find(key);
+			if (it == shard.entries.end())
+				return false;
+
+			std::forward<Func>(func)(it->second);
+			return true;
+		}
+
+		bool erase(const Key &key)
+		{
+			auto &&shard = getShard(key);
+			std::lock_guard lock(shard.guard);
+			return shard.entries.erase(key) != 0;
+		}
+
+	private:
+		// Every shard occupies its own cache lines, so threads
+		// working with neighbour shards don't share them.
+		struct alignas(64) Shard
+		{
+			std::mutex guard;
+			std::unordered_map<
+				Key,
+				Value,
+				std::hash<Key>,
+				std::equal_to<Key>,
+				Allocator
+			> entries;
+		};
+
+		static std::size_t getShardIndex(const Key &key)
+		{
+			return std::hash<Key>{}(key) % ShardCount;
+		}
+
+		Shard &getShard(const Key &key)
+		{
+			return m_shards[getShardIndex(key)];
+		}
+
+	private:
+		std::array<Shard, ShardCount> m_shards;
+};
@@ -0,0 +1,344 @@
+#pragma once
+
+// Drop-in replacement of boost::asio::read_until and
+// boost::asio::async_read_until for boost::asio::basic_streambuf.
+// Delimiter is searched with SSE2 or AVX2 instructions, the widest
+// instruction set supported by the CPU is chosen at runtime.
+// Search is resumed from the place where it stopped before the
+// previous read, so every received byte is scanned only once.
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_READ_UNTIL_X86
+#include <immintrin.h>
+#endif
+
+namespace simd
+{
+	namespace detail
+	{
+		inline const char *find_scalar(
+			const char *first,
+			const char *last,
+			std::string_view delim
+		)
+		{
+			auto pos = std::string_view(first, last - first).find(delim);
+			return pos == std::string_view::npos ? last : first + pos;
+		}
+
+#ifdef SIMD_READ_UNTIL_X86
+		// Both searches compare every position of the block against
+		// the first and the last bytes of the delimiter at once,
+		// only positions matching both are verified byte by byte.
+		inline const char *find_sse2(
+			const char *first,
+			const char *last,
+			std::string_view delim
+		)
+		{
+			constexpr std::size_t block = sizeof(__m128i);
+			const auto n = delim.size();
+			const auto first_byte = _mm_set1_epi8(delim.front());
+			const auto last_byte = _mm_set1_epi8(delim.back());
+
+			auto p = first;
+			for (; block + n - 1 <= static_cast<std::size_t>(last - p); p += block)
+			{
+				auto block_first = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(p)
+				);
+				auto block_last = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(p + n - 1)
+				);
+				auto mask = static_cast<unsigned>(
+					_mm_movemask_epi8(
+						_mm_and_si128(
+							_mm_cmpeq_epi8(first_byte, block_first),
+							_mm_cmpeq_epi8(last_byte, block_last)
+						)
+					)
+				);
+
+				while (mask)
+				{
+					auto candidate = p + __builtin_ctz(mask);
+					if (n < 3 || !std::memcmp(candidate + 1, delim.data() + 1, n - 2))
+						return candidate;
+					mask &= mask - 1;
+				}
+			}
+
+			return find_scalar(p, last, delim);
+		}
+
+		__attribute__((target("avx2")))
+		inline const char *find_avx2(
+			const char *first,
+			const char *last,
+			std::string_view delim
+		)
+		{
+			constexpr std::size_t block = sizeof(__m256i);
+			const auto n = delim.size();
+			const auto first_byte = _mm256_set1_epi8(delim.front());
+			const auto last_byte = _mm256_set1_epi8(delim.back());
+
+			auto p = first;
+			for (; block + n - 1 <= static_cast<std::size_t>(last - p); p += block)
+			{
+				auto block_first = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(p)
+				);
+				auto block_last = _mm256_loadu_si256(
+					reinterpret_cast<const __m256i*>(p + n - 1)
+				);
+				auto mask = static_cast<unsigned>(
+					_mm256_movemask_epi8(
+						_mm256_and_si256(
+							_mm256_cmpeq_epi8(first_byte, block_first),
+							_mm256_cmpeq_epi8(last_byte, block_last)
+						)
+					)
+				);
+
+				while (mask)
+				{
+					auto candidate = p + __builtin_ctz(mask);
+					if (n < 3 || !std::memcmp(candidate + 1, delim.data() + 1, n - 2))
+						return candidate;
+					mask &= mask - 1;
+				}
+			}
+
+			return find_sse2(p, last, delim);
+		}
+#endif
+	} // namespace detail
+
+	// Returns pointer to the first occurrence of the delimiter
+	// in range [first, last) or last if there is no one.
+	inline const char *find(
+		const char *first,
+		const char *last,
+		std::string_view delim
+	)
+	{
+		if (delim.empty())
+			return first;
+
+#ifdef SIMD_READ_UNTIL_X86
+		using find_type = const char *(*)(const char*, const char*, std::string_view);
+		static const find_type impl = __builtin_cpu_supports("avx2") ?
+			&detail::find_avx2 :
+			&detail::find_sse2;
+		return impl(first, last, delim);
+#else
+		return detail::find_scalar(first, last, delim);
+#endif
+	}
+
+	namespace detail
+	{
+		// Searches the delimiter in the data of the streambuf
+		// starting from search_position. Returns the size of data up
+		// to and including the delimiter or 0 if it isn't found yet.
+		// In the latter case search_position is moved to the first
+		// byte which may begin the delimiter.
+		template <class Allocator>
+		std::size_t search(
+			const boost::asio::basic_streambuf<Allocator> &b,
+			std::string_view delim,
+			std::size_t &search_position
+		)
+		{
+			auto data = b.data();
+			auto begin = static_cast<const char*>(data.data());
+			auto end = begin + data.size();
+
+			auto found = find(begin + search_position, end, delim);
+			if (found != end)
+				return found - begin + delim.size();
+
+			search_position = data.size() < delim.size() ?
+				0 : data.size() - delim.size() + 1;
+			return 0;
+		}
+
+		template <class Allocator>
+		std::size_t read_size(const boost::asio::basic_streambuf<Allocator> &b)
+		{
+			constexpr std::size_t min_size = 512;
+			constexpr std::size_t max_size = 64 * 1024;
+			return std::min(
+				std::max(min_size, b.capacity() - b.size()),
+				std::min(max_size, b.max_size() - b.size())
+			);
+		}
+
+		template <class AsyncReadStream, class Allocator>
+		class read_until_op
+		{
+			public:
+				read_until_op(
+					AsyncReadStream &stream,
+					boost::asio::basic_streambuf<Allocator> &b,
+					std::string_view delim
+				) :
+				m_stream(stream),
+				m_buf(b),
+				m_delim(delim)
+				{}
+
+				template <class Self>
+				void operator()(
+					Self &self,
+					boost::system::error_code ec = {},
+					std::size_t bytes_transferred = 0
+				)
+				{
+					if (m_started)
+					{
+						m_buf.commit(bytes_transferred);
+						if (ec)
+						{
+							self.complete(ec, 0);
+							return;
+						}
+					}
+
+					if (
+						auto size = search(m_buf, m_delim, m_search_position);
+						size
+					)
+					{
+						if (!m_started)
+						{
+							// Delimiter has been found in data received
+							// before. Completion handler must not be
+							// invoked from within the initiating function.
+							m_started = true;
+							boost::asio::post(
+								m_stream.get_executor(),
+								std::move(self)
+							);
+							return;
+						}
+						self.complete(ec, size);
+						return;
+					}
+					m_started = true;
+
+					if (m_buf.size() == m_buf.max_size())
+					{
+						self.complete(boost::asio::error::not_found, 0);
+						return;
+					}
+
+					m_stream.async_read_some(
+						m_buf.prepare(read_size(m_buf)),
+						std::move(self)
+					);
+				}
+
+			private:
+				AsyncReadStream &m_stream;
+				boost::asio::basic_streambuf<Allocator> &m_buf;
+				std::string m_delim;
+				std::size_t m_search_position = 0;
+				bool m_started = false;
+		};
+	} // namespace detail
+
+	template <class SyncReadStream, class Allocator>
+	std::size_t read_until(
+		SyncReadStream &stream,
+		boost::asio::basic_streambuf<Allocator> &b,
+		std::string_view delim,
+		boost::system::error_code &ec
+	)
+	{
+		ec = {};
+		std::size_t search_position = 0;
+		for (;;)
+		{
+			if (auto size = detail::search(b, delim, search_position); size)
+				return size;
+
+			if (b.size() == b.max_size())
+			{
+				ec = boost::asio::error::not_found;
+				return 0;
+			}
+
+			b.commit(
+				stream.read_some(b.prepare(detail::read_size(b)), ec)
+			);
+			if (ec)
+				return 0;
+		}
+	}
+
+	template <class SyncReadStream, class Allocator>
+	std::size_t read_until(
+		SyncReadStream &stream,
+		boost::asio::basic_streambuf<Allocator> &b,
+		std::string_view delim
+	)
+	{
+		boost::system::error_code ec;
+		auto size = simd::read_until(stream, b, delim, ec);
+		boost::asio::detail::throw_error(ec, "read_until");
+		return size;
+	}
+
+	template <class SyncReadStream, class Allocator>
+	std::size_t read_until(
+		SyncReadStream &stream,
+		boost::asio::basic_streambuf<Allocator> &b,
+		char delim
+	)
+	{
+		return simd::read_until(stream, b, std::string_view(&delim, 1));
+	}
+
+	template <class AsyncReadStream, class Allocator, class ReadHandler>
+	auto async_read_until(
+		AsyncReadStream &stream,
+		boost::asio::basic_streambuf<Allocator> &b,
+		std::string_view delim,
+		ReadHandler &&handler
+	)
+	{
+		return boost::asio::async_compose<
+			ReadHandler,
+			void (boost::system::error_code, std::size_t)
+		>(
+			detail::read_until_op<AsyncReadStream, Allocator>(stream, b, delim),
+			handler,
+			stream
+		);
+	}
+
+	template <class AsyncReadStream, class Allocator, class ReadHandler>
+	auto async_read_until(
+		AsyncReadStream &stream,
+		boost::asio::basic_streambuf<Allocator> &b,
+		char delim,
+		ReadHandler &&handler
+	)
+	{
+		return simd::async_read_until(
+			stream,
+			b,
+			std::string_view(&delim, 1),
+			std::forward<ReadHandler>(handler)
+		);
+	}
+} // namespace simd
@@ -0,0 +1,217 @@
+#pragma once
+
+// Hashed timing wheel (G. Varghese, T. Lauck) for an io_context run
+// by a single thread. There is one wheel per io_context, it's
+// obtained with boost::asio::use_service<TimingWheel>(ioc).
+// Timer is linked into the slot its expiry time hashes to, so both
+// arming and cancelling it take constant time however many timers
+// are outstanding. The wheel is driven by the single steady_timer
+// which ticks only while there are armed timers.
+// All methods must be called on the thread running the io_context.
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+class TimingWheel : public boost::asio::io_context::service
+{
+	private:
+		struct Node
+		{
+			Node *prev = this;
+			Node *next = this;
+		};
+
+	public:
+		using clock = std::chrono::steady_clock;
+
+		inline static boost::asio::io_context::id id;
+
+		// Timer is owned by the user of the wheel, usually it's
+		// a member of the object which deadline it tracks.
+		// Destroying the timer cancels it.
+		class Timer : private Node
+		{
+			public:
+				Timer() = default;
+				Timer(const Timer&) = delete;
+				Timer &operator=(const Timer&) = delete;
+
+				~Timer()
+				{
+					cancel();
+				}
+
+				bool isArmed() const
+				{
+					return m_wheel != nullptr;
+				}
+
+				void cancel()
+				{
+					if (m_wheel)
+						m_wheel->cancel(*this);
+				}
+
+			private:
+				friend class TimingWheel;
+
+				TimingWheel *m_wheel = nullptr;
+				std::size_t m_rounds = 0;
+				std::function<void ()> m_on_expire;
+		};
+
+		explicit TimingWheel(boost::asio::io_context &ioc) :
+		boost::asio::io_context::service(ioc),
+		m_tick_timer(ioc)
+		{}
+
+		// Arms the timer, on_expire is called when the timeout
+		// elapses unless the timer is cancelled before.
+		// Timer which is already armed is rearmed.
+		template <class OnExpire>
+		void schedule(Timer &timer, clock::duration timeout, OnExpire &&on_expire)
+		{
+			cancel(timer);
+
+			if (!m_ticking && !m_count)
+				m_next_tick_time = clock::now() + TICK;
+
+			// Number of ticks after the next one when the timer
+			// expires, rounded up.
+			auto delay = clock::now() + timeout - m_next_tick_time;
+			std::size_t ticks = delay <= clock::duration::zero() ?
+				0 : static_cast<std::size_t>((delay + TICK - clock::duration(1)) / TICK);
+
+			timer.m_wheel = this;
+			timer.m_rounds = ticks / SLOT_COUNT;
+			timer.m_on_expire = std::forward<OnExpire>(on_expire);
+			link(m_slots[(m_cursor + ticks) % SLOT_COUNT], timer);
+			++m_count;
+
+			if (!m_ticking)
+				startTicking();
+		}
+
+		void cancel(Timer &timer)
+		{
+			if (!timer.m_wheel)
+				return;
+
+			unlink(timer);
+			timer.m_wheel = nullptr;
+			timer.m_on_expire = nullptr;
+			--m_count;
+		}
+
+	private:
+		void shutdown() override
+		{
+			for (auto &&slot : m_slots)
+			{
+				while (slot.next != &slot)
+				{
+					auto timer = static_cast<Timer*>(slot.next);
+					unlink(*timer);
+					timer->m_wheel = nullptr;
+					timer->m_on_expire = nullptr;
+				}
+			}
+			m_count = 0;
+		}
+
+		void startTicking()
+		{
+			m_ticking = true;
+			m_tick_timer.expires_at(m_next_tick_time);
+			m_tick_timer.async_wait(
+				[this](auto &&ec)
+				{
+					if (!ec)
+						onTick();
+				}
+			);
+		}
+
+		void onTick()
+		{
+			// Ticks which have been missed while the thread was
+			// busy are processed too.
+			for (auto now = clock::now(); m_next_tick_time <= now; )
+			{
+				// Expired timers are moved to the separate list
+				// first, their callbacks may arm and cancel other
+				// timers including those in the current slot.
+				Node expired;
+				auto &&slot = m_slots[m_cursor];
+				for (auto node = slot.next; node != &slot; )
+				{
+					auto timer = static_cast<Timer*>(node);
+					node = node->next;
+
+					if (timer->m_rounds)
+					{
+						--timer->m_rounds;
+						continue;
+					}
+
+					unlink(*timer);
+					link(expired, *timer);
+				}
+
+				m_cursor = (m_cursor + 1) % SLOT_COUNT;
+				m_next_tick_time += TICK;
+
+				while (expired.next != &expired)
+				{
+					auto timer = static_cast<Timer*>(expired.next);
+					unlink(*timer);
+					timer->m_wheel = nullptr;
+					--m_count;
+
+					// Callback may destroy the timer.
+					auto on_expire = std::move(timer->m_on_expire);
+					timer->m_on_expire = nullptr;
+					on_expire();
+				}
+			}
+
+			if (m_count)
+				startTicking();
+			else
+				m_ticking = false;
+		}
+
+		static void link(Node &list, Node &node)
+		{
+			node.prev = list.prev;
+			node.next = &list;
+			list.prev->next = &node;
+			list.prev = &node;
+		}
+
+		static void unlink(Node &node)
+		{
+			node.prev->next = node.next;
+			node.next->prev = node.prev;
+			node.prev = node.next = &node;
+		}
+
+	private:
+		// Timeouts are rounded up to the tick, one revolution
+		// of the wheel takes 5.12 seconds. Longer timeouts wait
+		// for the required number of revolutions in their slots.
+		constexpr inline static clock::duration TICK = std::chrono::milliseconds(10);
+		constexpr inline static std::size_t SLOT_COUNT = 512;
+
+		std::array<Node, SLOT_COUNT> m_slots;
+		std::size_t m_cursor = 0;            // Slot processed on the next tick.
+		clock::time_point m_next_tick_time;
+		std::size_t m_count = 0;             // Number of armed timers.
+		bool m_ticking = false;
+		boost::asio::steady_timer m_tick_timer;
+};